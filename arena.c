@@ -0,0 +1,104 @@
+#include <stdlib.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 8
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new Arena that allocates blocks of at least blockSize bytes
+Arena* Arena_init(size_t blockSize){
+    Arena* result = (Arena*) malloc(sizeof(Arena));
+
+    result->blockSize = blockSize;
+    result->numberOfBlocks = 0;
+    result->capacity = 0;
+    result->blocks = NULL;
+    result->blockSizes = NULL;
+
+    result->currentBlock = -1;
+    result->used = 0;
+
+    return result;
+}
+
+// allocate memory from an Arena (freed all at once by Arena_reset or Arena_free)
+// allocations are bumped out of the current block, moving on to the next block when it is full
+void* Arena_alloc(Arena* instance, size_t size){
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+
+    if (instance->currentBlock == -1 || instance->used + size > instance->blockSizes[instance->currentBlock]){
+        // reuse the next block if it is large enough
+        int next = instance->currentBlock + 1;
+        if (next < instance->numberOfBlocks && instance->blockSizes[next] >= size){
+            instance->currentBlock = next;
+            instance->used = 0;
+        } else {
+            size_t blockSize = instance->blockSize;
+            if (size > blockSize){
+                blockSize = size;
+            }
+
+            if (instance->numberOfBlocks == instance->capacity){
+                instance->capacity = instance->capacity ? instance->capacity * 2 : 8;
+                instance->blocks = realloc(instance->blocks, sizeof(char*) * instance->capacity);
+                instance->blockSizes = realloc(instance->blockSizes, sizeof(size_t) * instance->capacity);
+            }
+
+            // the new block goes right after the current one so it is used next
+            for (int i=instance->numberOfBlocks; i>next; i--){
+                instance->blocks[i] = instance->blocks[i-1];
+                instance->blockSizes[i] = instance->blockSizes[i-1];
+            }
+            instance->blocks[next] = (char*) malloc(blockSize);
+            instance->blockSizes[next] = blockSize;
+            instance->numberOfBlocks++;
+
+            instance->currentBlock = next;
+            instance->used = 0;
+
+            DBG("Arena allocated a block of %zu bytes (%d blocks)\n", blockSize, instance->numberOfBlocks);
+        }
+    }
+
+    void* result = instance->blocks[instance->currentBlock] + instance->used;
+    instance->used += size;
+    return result;
+}
+
+// remember how much of an Arena is in use
+ArenaMark Arena_mark(Arena* instance){
+    ArenaMark result;
+    result.block = instance->currentBlock;
+    result.used = instance->used;
+    return result;
+}
+
+// free every allocation made since a mark
+int Arena_rewind(Arena* instance, ArenaMark mark){
+    instance->currentBlock = mark.block;
+    instance->used = mark.used;
+    return 0;
+}
+
+// free every allocation of an Arena at once, keeping its blocks for reuse
+int Arena_reset(Arena* instance){
+    instance->currentBlock = -1;
+    instance->used = 0;
+    return 0;
+}
+
+// free an Arena and all of its blocks
+int Arena_free(Arena* instance){
+    for (int i=0; i<instance->numberOfBlocks; i++){
+        free(instance->blocks[i]);
+    }
+    free(instance->blocks);
+    free(instance->blockSizes);
+    free(instance);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#include "structures.h"
+
+// initialize a new Arena that allocates blocks of at least blockSize bytes
+Arena* Arena_init(size_t blockSize);
+
+// allocate memory from an Arena (freed all at once by Arena_reset or Arena_free)
+void* Arena_alloc(Arena* instance, size_t size);
+
+// remember how much of an Arena is in use
+ArenaMark Arena_mark(Arena* instance);
+
+// free every allocation made since a mark
+int Arena_rewind(Arena* instance, ArenaMark mark);
+
+// free every allocation of an Arena at once, keeping its blocks for reuse
+int Arena_reset(Arena* instance);
+
+// free an Arena and all of its blocks
+int Arena_free(Arena* instance);
+
+#endif
@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "sequence.h"
+#include "context.h"
+#include "engine.h"
+#include "cache.h"
+#include "stats.h"
+#include "batch.h"
+
+// a chunk is handed to a worker once it has this many lines or bytes
+#define BATCH_CHUNK_LINES 256
+#define BATCH_CHUNK_BYTES (64 * 1024)
+
+// chunks in flight for each worker
+#define BATCH_SLOTS_PER_WORKER 4
+
+///////////////////////////////////////////
+// Private Functions
+
+// add a line (with its newline) to the end of a chunk
+int BatchSlot_addLine(BatchSlot* instance, char* line, size_t length){
+    if (instance->textLength + length > instance->textCapacity){
+        instance->textCapacity = (instance->textLength + length) * 2;
+        instance->text = (char*) realloc(instance->text, instance->textCapacity);
+    }
+    if (instance->numberOfLines == instance->lineCapacity){
+        instance->lineCapacity = instance->lineCapacity ? instance->lineCapacity * 2 : 64;
+        instance->lineStarts = (size_t*) realloc(instance->lineStarts, sizeof(size_t) * instance->lineCapacity);
+        instance->lineLengths = (size_t*) realloc(instance->lineLengths, sizeof(size_t) * instance->lineCapacity);
+    }
+    memcpy(instance->text + instance->textLength, line, length);
+    instance->lineStarts[instance->numberOfLines] = instance->textLength;
+    instance->lineLengths[instance->numberOfLines] = length;
+    instance->textLength += length;
+    instance->numberOfLines++;
+    return 0;
+}
+
+// take chunks until the reader is finished and every chunk is taken
+void* Batch_work(void* argument){
+    BatchWorker* worker = (BatchWorker*) argument;
+    Batch* batch = worker->batch;
+
+    while (1){
+        pthread_mutex_lock(&batch->lock);
+        while (batch->nextWork == batch->nextRead && !batch->finished){
+            pthread_cond_wait(&batch->slotFilled, &batch->lock);
+        }
+        if (batch->nextWork == batch->nextRead){
+            pthread_mutex_unlock(&batch->lock);
+            return NULL;
+        }
+        BatchSlot* slot = &batch->slots[batch->nextWork % batch->numberOfSlots];
+        batch->nextWork++;
+        pthread_mutex_unlock(&batch->lock);
+
+        slot->output.length = 0;
+        for (int i=0; i<slot->numberOfLines; i++){
+            Batch_executeLine(worker->context, slot->text + slot->lineStarts[i], slot->lineLengths[i], batch->metric, batch->direction, &slot->output);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        slot->state = BATCH_SLOT_DONE;
+        pthread_cond_broadcast(&batch->slotDone);
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
+
+// write finished chunks in input order
+int Batch_write(Batch* instance, FILE* output){
+    while (1){
+        pthread_mutex_lock(&instance->lock);
+        BatchSlot* slot = &instance->slots[instance->nextWrite % instance->numberOfSlots];
+        while (slot->state != BATCH_SLOT_DONE && !(instance->finished && instance->nextWrite == instance->nextRead)){
+            pthread_cond_wait(&instance->slotDone, &instance->lock);
+        }
+        if (slot->state != BATCH_SLOT_DONE){
+            pthread_mutex_unlock(&instance->lock);
+            return 0;
+        }
+        pthread_mutex_unlock(&instance->lock);
+
+        fwrite(slot->output.bytes, 1, slot->output.length, output);
+        fflush(output);
+
+        pthread_mutex_lock(&instance->lock);
+        slot->state = BATCH_SLOT_EMPTY;
+        instance->nextWrite++;
+        pthread_cond_signal(&instance->slotFree);
+        pthread_mutex_unlock(&instance->lock);
+    }
+}
+
+// argument of the writer thread
+typedef struct BatchWriter{
+    Batch* batch;
+    FILE* output;
+} BatchWriter;
+
+void* Batch_writeThread(void* argument){
+    BatchWriter* writer = (BatchWriter*) argument;
+    Batch_write(writer->batch, writer->output);
+    return NULL;
+}
+
+
+///////////////////////////////////////////
+// Public Functions
+
+// append bytes to an OutputBuffer
+int OutputBuffer_append(OutputBuffer* instance, char* bytes, size_t length){
+    if (instance->length + length > instance->capacity){
+        instance->capacity = (instance->length + length) * 2;
+        instance->bytes = (char*) realloc(instance->bytes, instance->capacity);
+    }
+    memcpy(instance->bytes + instance->length, bytes, length);
+    instance->length += length;
+    return 0;
+}
+
+// execute an Engine on one line of input (as read by getline) and append the result to output
+// tokens are interned straight from the line, which is left untouched
+// a result the context's limits cut short starts with BATCH_PARTIAL_PREFIX (and is not cached)
+int Batch_executeLine(Context* context, char* line, size_t bytesRead, int metric, int direction, OutputBuffer* output){
+    // the same line may have been rewritten before
+    size_t outputStart = output->length;
+    if (context->cache != NULL && Cache_lookup(context->cache, metric, direction, line, bytesRead, output)){
+        return 0;
+    }
+
+    // tokens of the previous line are not needed anymore
+    Context_clearSymbols(context);
+
+    // the last byte is the newline
+    size_t lineLength = bytesRead > 0 ? bytesRead - 1 : 0;
+
+    DBG("Received input. Parsing...\n");
+    DBG("Input:\n%.*s\n", (int) lineLength, line);
+
+    // break the line up into tokens at spaces in one pass
+    int numberOfInputTokens = 0;
+    size_t tokenStart = 0;
+    for (size_t i=0; i<=lineLength; i++){
+        if (i < lineLength && line[i] != ' '){
+            continue;
+        }
+        if (numberOfInputTokens == context->inputCapacity){
+            context->inputCapacity = context->inputCapacity ? context->inputCapacity * 2 : 64;
+            context->inputTokens = (int*) realloc(context->inputTokens, sizeof(int) * context->inputCapacity);
+        }
+
+        // intern the token so the engine can compare ids
+        context->inputTokens[numberOfInputTokens] = Context_intern(context, line + tokenStart, i - tokenStart);
+        numberOfInputTokens++;
+        tokenStart = i + 1;
+    }
+    int* inputTokens = context->inputTokens;
+
+    DBG("Parsed into %d tokens\n", numberOfInputTokens);
+
+    DBG("Executing engine on input...\n");
+
+    Sequence* sequence = Sequence_init(inputTokens, numberOfInputTokens);
+    int partial = Engine_execute(context->engine, context, sequence, metric, direction);
+
+    DBG("FINAL RESULT:\n");
+    if (partial){
+        OutputBuffer_append(output, BATCH_PARTIAL_PREFIX, strlen(BATCH_PARTIAL_PREFIX));
+    }
+    for (int i=0; i<SEQUENCE_LENGTH(sequence); i++){
+        char* token = Context_lookup(context, SEQUENCE_GET(sequence, i));
+        OutputBuffer_append(output, token, strlen(token));
+        OutputBuffer_append(output, " ", 1);
+    }
+    OutputBuffer_append(output, "\n", 1);
+
+    Sequence_free(sequence);
+
+    if (context->cache != NULL && !partial){
+        Cache_insert(context->cache, metric, direction, line, bytesRead, output->bytes + outputStart, output->length - outputStart);
+    }
+    return 0;
+}
+
+// initialize a new Batch with numberOfWorkers workers that share one Engine
+// cache = results shared by every worker (NULL = none)
+// stats = gets the counters of every worker (NULL = none)
+Batch* Batch_init(Engine* engine, int numberOfWorkers, int metric, int direction, Cache* cache, Stats* stats){
+    Batch* result = (Batch*) malloc(sizeof(Batch));
+
+    result->engine = engine;
+    result->metric = metric;
+    result->direction = direction;
+
+    result->numberOfWorkers = numberOfWorkers;
+    result->workers = (BatchWorker*) malloc(sizeof(BatchWorker) * numberOfWorkers);
+    for (int i=0; i<numberOfWorkers; i++){
+        result->workers[i].batch = result;
+        result->workers[i].context = Context_init(engine);
+        result->workers[i].context->cache = cache;
+        if (stats != NULL){
+            Stats_addContext(stats, result->workers[i].context);
+        }
+    }
+
+    result->numberOfSlots = numberOfWorkers * BATCH_SLOTS_PER_WORKER;
+    result->slots = (BatchSlot*) calloc(result->numberOfSlots, sizeof(BatchSlot));
+
+    pthread_mutex_init(&result->lock, NULL);
+    pthread_cond_init(&result->slotFilled, NULL);
+    pthread_cond_init(&result->slotDone, NULL);
+    pthread_cond_init(&result->slotFree, NULL);
+
+    return result;
+}
+
+// execute every line of input and write the results to output in input order
+// the calling thread reads, one thread writes and the workers execute
+int Batch_run(Batch* instance, FILE* input, FILE* output){
+    instance->nextRead = 0;
+    instance->nextWork = 0;
+    instance->nextWrite = 0;
+    instance->finished = 0;
+
+    for (int i=0; i<instance->numberOfWorkers; i++){
+        if (pthread_create(&instance->workers[i].thread, NULL, Batch_work, &instance->workers[i])){
+            PANIC("Could not start worker thread %d\n", i);
+        }
+    }
+    BatchWriter writer = {instance, output};
+    pthread_t writeThread;
+    if (pthread_create(&writeThread, NULL, Batch_writeThread, &writer)){
+        PANIC("Could not start writer thread\n");
+    }
+
+    char* line = NULL;
+    size_t lineLength = 0;
+    ssize_t bytesRead = 0;
+    while (bytesRead != -1){
+        // wait for the writer to free the slot of the next chunk
+        pthread_mutex_lock(&instance->lock);
+        while (instance->nextRead - instance->nextWrite >= instance->numberOfSlots){
+            pthread_cond_wait(&instance->slotFree, &instance->lock);
+        }
+        pthread_mutex_unlock(&instance->lock);
+
+        BatchSlot* slot = &instance->slots[instance->nextRead % instance->numberOfSlots];
+        slot->textLength = 0;
+        slot->numberOfLines = 0;
+        while (slot->numberOfLines < BATCH_CHUNK_LINES && slot->textLength < BATCH_CHUNK_BYTES){
+            bytesRead = getline(&line, &lineLength, input);
+            // EOF reached
+            if (bytesRead == -1){
+                break;
+            }
+            BatchSlot_addLine(slot, line, bytesRead);
+        }
+
+        if (slot->numberOfLines > 0){
+            pthread_mutex_lock(&instance->lock);
+            slot->state = BATCH_SLOT_FILLED;
+            instance->nextRead++;
+            pthread_cond_signal(&instance->slotFilled);
+            pthread_mutex_unlock(&instance->lock);
+        }
+    }
+    free(line);
+
+    pthread_mutex_lock(&instance->lock);
+    instance->finished = 1;
+    pthread_cond_broadcast(&instance->slotFilled);
+    pthread_cond_broadcast(&instance->slotDone);
+    pthread_mutex_unlock(&instance->lock);
+
+    for (int i=0; i<instance->numberOfWorkers; i++){
+        pthread_join(instance->workers[i].thread, NULL);
+    }
+    pthread_join(writeThread, NULL);
+
+    DBG("Batch finished (%ld chunks)\n", instance->nextRead);
+    return 0;
+}
+
+// free a Batch and the Contexts of its workers
+int Batch_free(Batch* instance){
+    for (int i=0; i<instance->numberOfWorkers; i++){
+        Context_free(instance->workers[i].context);
+    }
+    free(instance->workers);
+
+    for (int i=0; i<instance->numberOfSlots; i++){
+        free(instance->slots[i].text);
+        free(instance->slots[i].lineStarts);
+        free(instance->slots[i].lineLengths);
+        free(instance->slots[i].output.bytes);
+    }
+    free(instance->slots);
+
+    pthread_mutex_destroy(&instance->lock);
+    pthread_cond_destroy(&instance->slotFilled);
+    pthread_cond_destroy(&instance->slotDone);
+    pthread_cond_destroy(&instance->slotFree);
+    free(instance);
+    return 0;
+}
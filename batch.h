@@ -0,0 +1,34 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#include "structures.h"
+
+#define BATCH_SLOT_EMPTY 0
+#define BATCH_SLOT_FILLED 1
+#define BATCH_SLOT_DONE 2
+
+// starts the result of a line that a limit stopped before its fixpoint
+#define BATCH_PARTIAL_PREFIX "partial: "
+
+// append bytes to an OutputBuffer
+int OutputBuffer_append(OutputBuffer* instance, char* bytes, size_t length);
+
+// execute an Engine on one line of input (as read by getline) and append the result to output
+// tokens are interned straight from the line, which is left untouched
+// a result the context's limits cut short starts with BATCH_PARTIAL_PREFIX (and is not cached)
+int Batch_executeLine(Context* context, char* line, size_t bytesRead, int metric, int direction, OutputBuffer* output);
+
+// initialize a new Batch with numberOfWorkers workers that share one Engine
+// cache = results shared by every worker (NULL = none)
+// stats = gets the counters of every worker (NULL = none)
+Batch* Batch_init(Engine* engine, int numberOfWorkers, int metric, int direction, Cache* cache, Stats* stats);
+
+// execute every line of input and write the results to output in input order
+int Batch_run(Batch* instance, FILE* input, FILE* output);
+
+// free a Batch and the Contexts of its workers
+int Batch_free(Batch* instance);
+
+#endif
@@ -0,0 +1,93 @@
+"""
+Generate benchmark input lines for a database from bench/generate_rules.py
+
+Lines are random vocabulary tokens with instances of source clauses planted in them.
+
+usage: bench/generate_inputs.py [options] rules.rbe > input.txt
+"""
+
+import argparse
+import random
+import re
+
+
+def parse_range(text):
+    # "3" or "2:6"
+    if ":" in text:
+        low, high = text.split(":")
+        return int(low), int(high)
+    return int(text), int(text)
+
+
+def read_source_clauses(filename):
+    # every clause of every rule except the first (the target)
+    sources = []
+    for line in open(filename):
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        clauses = re.findall(r'"([^"]*)"', line)
+        sources += [clause.split() for clause in clauses[1:]]
+    return sources
+
+
+def instantiate_token(rng, token, vocabulary):
+    # input tokens matched by one token of a clause
+    token = token.split("$")[0]
+    repetitions = 1
+    if token.endswith("*"):
+        token = token[:-1]
+        repetitions = rng.randint(0, 2)
+    elif token.endswith("+"):
+        token = token[:-1]
+        repetitions = rng.randint(1, 3)
+
+    result = []
+    for _ in range(repetitions):
+        if token == ".":
+            result.append("t%d" % rng.randrange(vocabulary))
+        else:
+            result.append(rng.choice(token.split("|")))
+    return result
+
+
+def generate_line(rng, options, sources):
+    length = rng.randint(*options.length)
+    line = []
+    while len(line) < length:
+        if sources and rng.random() < options.density:
+            clause = rng.choice(sources)
+            for token in clause:
+                line += instantiate_token(rng, token, options.vocabulary)
+        elif rng.random() < options.unknown:
+            line.append("u%d" % rng.randrange(1000000))
+        else:
+            line.append("t%d" % rng.randrange(options.vocabulary))
+    return " ".join(line[:max(length, 1)])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate benchmark input lines")
+    parser.add_argument("rules", help="database written by bench/generate_rules.py")
+    parser.add_argument("--lines", type=int, default=10000, help="number of lines")
+    parser.add_argument("--length", type=parse_range, default=(8, 32), help="tokens per line, MIN:MAX")
+    parser.add_argument("--density", type=float, default=0.2, help="chance that the next tokens are a planted source clause")
+    parser.add_argument("--repeat", type=float, default=0.0, help="share of lines that repeat an earlier line")
+    parser.add_argument("--unknown", type=float, default=0.05, help="share of filler tokens outside the vocabulary")
+    parser.add_argument("--vocabulary", type=int, default=200, help="vocabulary size the rules were generated with")
+    parser.add_argument("--seed", type=int, default=1)
+    options = parser.parse_args()
+
+    rng = random.Random(options.seed)
+    sources = read_source_clauses(options.rules)
+    lines = []
+    for _ in range(options.lines):
+        if lines and rng.random() < options.repeat:
+            lines.append(rng.choice(lines))
+        else:
+            lines.append(generate_line(rng, options, sources))
+    print("\n".join(lines))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,100 @@
+"""
+Generate a synthetic rule database for benchmarks
+
+Every rule has one short target clause and longer source clauses.
+Metric 0 of a clause is its number of tokens and the target always has
+fewer tokens a match must cover, so minimizing metric 0 always terminates.
+The other metrics (--metrics) are random.
+
+usage: bench/generate_rules.py [options] > rules.rbe
+"""
+
+import argparse
+import random
+
+
+def parse_range(text):
+    # "3" or "2:6"
+    if ":" in text:
+        low, high = text.split(":")
+        return int(low), int(high)
+    return int(text), int(text)
+
+
+def vocabulary_token(rng, vocabulary):
+    return "t%d" % rng.randrange(vocabulary)
+
+
+def source_token(rng, options):
+    # one token of a source clause and whether a match always covers at least one input token
+    roll = rng.random()
+    if roll < options.any:
+        token = "."
+    elif roll < options.any + options.alternation:
+        token = "|".join(vocabulary_token(rng, options.vocabulary) for _ in range(rng.randint(2, 3)))
+    else:
+        token = vocabulary_token(rng, options.vocabulary)
+
+    roll = rng.random()
+    if roll < options.star:
+        return token + "*", False
+    if roll < options.star + options.plus:
+        return token + "+", True
+    return token, True
+
+
+def metric_string(rng, number_of_tokens, number_of_metrics):
+    metrics = [str(number_of_tokens)] + [str(rng.randint(0, 9)) for _ in range(number_of_metrics - 1)]
+    return ":".join(metrics)
+
+
+def generate_rule(rng, options):
+    low, high = options.length
+    target_literals = rng.randint(1, max(1, low - 1))
+    number_of_variables = 1 if rng.random() < options.variables else 0
+
+    # target: literals then the variables
+    target = [vocabulary_token(rng, options.vocabulary) for _ in range(target_literals)]
+    target += [".$%d" % i for i in range(number_of_variables)]
+    clauses = ['"%s"~%s' % (" ".join(target), metric_string(rng, len(target), options.metrics))]
+
+    for _ in range(options.clauses - 1):
+        # the tokens that always cover input must outnumber the target's literals
+        while True:
+            length = rng.randint(max(low, target_literals + 1), max(high, target_literals + 1))
+            tokens = [source_token(rng, options) for _ in range(length)]
+            # and at least one literal anchors the clause
+            anchored = any(not token.startswith(".") for token, _ in tokens)
+            if anchored and sum(1 for _, covers in tokens if covers) > target_literals:
+                break
+        tokens = [token for token, _ in tokens]
+        # the variables bind .* anywhere in the clause
+        for i in range(number_of_variables):
+            tokens.insert(rng.randint(0, len(tokens)), ".*$%d" % i)
+        clauses.append('"%s"~%s' % (" ".join(tokens), metric_string(rng, len(tokens), options.metrics)))
+
+    return " = ".join(clauses) + ";"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a synthetic rule database")
+    parser.add_argument("--rules", type=int, default=100, help="number of rules")
+    parser.add_argument("--clauses", type=int, default=2, help="clauses per rule (one target, the rest sources)")
+    parser.add_argument("--length", type=parse_range, default=(2, 6), help="tokens per source clause, MIN:MAX")
+    parser.add_argument("--any", type=float, default=0.1, help="share of . tokens")
+    parser.add_argument("--star", type=float, default=0.05, help="share of tokens with *")
+    parser.add_argument("--plus", type=float, default=0.05, help="share of tokens with +")
+    parser.add_argument("--alternation", type=float, default=0.05, help="share of a|b tokens")
+    parser.add_argument("--variables", type=float, default=0.2, help="share of rules that bind a $n variable")
+    parser.add_argument("--metrics", type=int, default=1, help="metrics per clause (metric 0 is the length)")
+    parser.add_argument("--vocabulary", type=int, default=200, help="number of distinct literal tokens")
+    parser.add_argument("--seed", type=int, default=1)
+    options = parser.parse_args()
+
+    rng = random.Random(options.seed)
+    for _ in range(options.rules):
+        print(generate_rule(rng, options))
+
+
+if __name__ == '__main__':
+    main()
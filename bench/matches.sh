@@ -0,0 +1,36 @@
+#!/bin/sh
+# Rewrite one line with a very large number of matches under a small stack limit.
+# usage: bench/matches.sh [number_of_matches]
+# RBE can be set to the binary to run (default ./rbe)
+# RBE_BASELINE can be set to an older binary to compare the throughput with
+# (run without the stack limit, since a recursive scan needs a frame per match)
+N=${1:-100000}
+RBE=${RBE:-./rbe}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+echo '"a"~2 = "b"~1;' > "$DIR/matches.rbe"
+awk -v n="$N" 'BEGIN { for (i=0; i<n; i++) printf "a%s", (i+1<n ? " " : "\n") }' > "$DIR/input.txt"
+awk -v n="$N" 'BEGIN { for (i=0; i<n; i++) printf "b%s", (i+1<n ? " " : "\n") }' > "$DIR/expected.txt"
+
+# run_rbe <name> <binary> <stack limit in KB or unlimited>: prints the rate and keeps the seconds in $DIR/<name>.seconds
+run_rbe() {
+    START=$(date +%s.%N)
+    (ulimit -s "$3"; "$2" 0 -1 "$DIR/matches.rbe" < "$DIR/input.txt" > "$DIR/output.txt") || { echo "$1 failed"; exit 1; }
+    END=$(date +%s.%N)
+
+    if [ "$(sed "s/ *$//" "$DIR/output.txt")" != "$(cat "$DIR/expected.txt")" ]; then
+        echo "$1: unexpected output"
+        exit 1
+    fi
+
+    awk -v s="$START" -v e="$END" 'BEGIN { printf "%.6f\n", e - s }' > "$DIR/$1.seconds"
+    awk -v name="$1" -v n="$N" -v t="$(cat "$DIR/$1.seconds")" 'BEGIN { printf "%s: %d matches in %.3fs (%.0f matches/s)\n", name, n, t, (t > 0 ? n / t : 0) }'
+}
+
+run_rbe rbe "$RBE" 256
+
+if [ -n "$RBE_BASELINE" ]; then
+    run_rbe baseline "$RBE_BASELINE" "$(ulimit -H -s)"
+    awk -v t="$(cat "$DIR/rbe.seconds")" -v b="$(cat "$DIR/baseline.seconds")" 'BEGIN { printf "throughput: %.2fx the baseline\n", (t > 0 ? b / t : 0) }'
+fi
@@ -0,0 +1,172 @@
+"""
+Benchmark driver: generates synthetic databases and inputs, runs ./rbe on them
+and prints one JSON object per scenario (tokens/s, requests/s, latency percentiles,
+passes per request and peak RSS) so results can be compared across commits.
+
+usage: bench/run.py [--rbe ./rbe] [--output results.jsonl] [--baseline old.jsonl] [--scenario NAME ...]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIRECTORY = os.path.dirname(os.path.abspath(__file__))
+
+# name, generate_rules.py options, generate_inputs.py options, rbe options
+SCENARIOS = [
+    ("literal", ["--rules", "500", "--any", "0", "--star", "0", "--plus", "0", "--alternation", "0", "--variables", "0"], ["--lines", "20000"], []),
+    ("wildcards", ["--rules", "500", "--any", "0.3", "--star", "0.15", "--plus", "0.15"], ["--lines", "10000"], []),
+    ("alternation", ["--rules", "500", "--alternation", "0.4"], ["--lines", "10000"], []),
+    ("variables", ["--rules", "300", "--variables", "1"], ["--lines", "10000"], []),
+    ("multi_metric", ["--rules", "500", "--clauses", "4", "--metrics", "3"], ["--lines", "10000"], []),
+    ("long_lines", ["--rules", "500"], ["--lines", "500", "--length", "500:1000", "--density", "0.3"], []),
+    ("repeated_cached", ["--rules", "500"], ["--lines", "20000", "--repeat", "0.9"], ["--cache-entries", "65536"]),
+    ("no_matches", ["--rules", "2000"], ["--lines", "20000", "--density", "0", "--unknown", "0.5"], []),
+]
+
+# metrics where a lower value is better (the rest are better when higher)
+LOWER_IS_BETTER = ["latency_p50_us", "latency_p99_us", "latency_p999_us", "peak_rss_kb", "seconds"]
+
+
+def generate(script, arguments, output_filename):
+    with open(output_filename, "w") as output:
+        subprocess.run([sys.executable, os.path.join(BENCH_DIRECTORY, script)] + arguments, stdout=output, check=True)
+
+
+def percentile(sorted_values, fraction):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(fraction * len(sorted_values)))
+    return sorted_values[index]
+
+
+def measure_throughput(rbe, options, rules_filename, input_filename):
+    # every line piped through at once
+    with open(input_filename, "rb") as input_file:
+        start = time.perf_counter()
+        process = subprocess.Popen([rbe, "--stats"] + options + ["0", "-1", rules_filename], stdin=input_file, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+        stderr = process.stderr.read().decode()
+        process.wait()
+        seconds = time.perf_counter() - start
+    if process.returncode != 0:
+        raise RuntimeError("rbe failed: " + stderr)
+
+    # stats: X executions, Y passes, Z substitutions
+    # memory: N KB peak resident
+    executions = passes = substitutions = peak_rss_kb = 0
+    for line in stderr.splitlines():
+        fields = line.split()
+        if line.startswith("stats:"):
+            executions, passes, substitutions = int(fields[1]), int(fields[3]), int(fields[5])
+        elif line.startswith("memory:"):
+            peak_rss_kb = int(fields[1])
+    return seconds, peak_rss_kb, executions, passes, substitutions
+
+
+def measure_latency(rbe, options, rules_filename, lines):
+    # one request at a time, waiting for each response (includes the pipe round trip)
+    process = subprocess.Popen([rbe] + options + ["0", "-1", rules_filename], stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    latencies = []
+    for line in lines:
+        start = time.perf_counter()
+        process.stdin.write(line)
+        process.stdin.flush()
+        process.stdout.readline()
+        latencies.append((time.perf_counter() - start) * 1e6)
+    process.stdin.close()
+    process.wait()
+    latencies.sort()
+    return latencies
+
+
+def run_scenario(rbe, scenario, directory, latency_requests):
+    name, rule_options, input_options, options = scenario
+    rules_filename = os.path.join(directory, name + ".rbe")
+    input_filename = os.path.join(directory, name + ".txt")
+    generate("generate_rules.py", rule_options, rules_filename)
+    generate("generate_inputs.py", [rules_filename] + input_options + ["--vocabulary", "200"], input_filename)
+
+    with open(input_filename, "rb") as input_file:
+        lines = input_file.readlines()
+    number_of_tokens = sum(len(line.split()) for line in lines)
+
+    seconds, peak_rss_kb, executions, passes, substitutions = measure_throughput(rbe, options, rules_filename, input_filename)
+    latencies = measure_latency(rbe, options, rules_filename, lines[:latency_requests])
+
+    return {
+        "scenario": name,
+        "requests": len(lines),
+        "tokens": number_of_tokens,
+        "seconds": round(seconds, 4),
+        "requests_per_second": round(len(lines) / seconds, 1),
+        "tokens_per_second": round(number_of_tokens / seconds, 1),
+        "latency_p50_us": round(percentile(latencies, 0.5), 1),
+        "latency_p99_us": round(percentile(latencies, 0.99), 1),
+        "latency_p999_us": round(percentile(latencies, 0.999), 1),
+        # per request that was executed (cache hits run no passes)
+        "passes_per_request": round(passes / executions, 3) if executions else 0,
+        "substitutions_per_request": round(substitutions / executions, 3) if executions else 0,
+        "peak_rss_kb": peak_rss_kb,
+    }
+
+
+def git_commit():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], capture_output=True, check=True).stdout.decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def compare(result, baseline):
+    # relative change of every metric (positive = better)
+    changes = []
+    for key, value in result.items():
+        old = baseline.get(key)
+        if not isinstance(value, (int, float)) or not isinstance(old, (int, float)) or old == 0:
+            continue
+        if key.endswith("_per_second") or key in LOWER_IS_BETTER:
+            change = (value - old) / old
+            if key in LOWER_IS_BETTER:
+                change = -change
+            changes.append("%s %+.1f%%" % (key, 100 * change))
+    return "%s: %s" % (result["scenario"], ", ".join(changes))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the rbe benchmark scenarios")
+    parser.add_argument("--rbe", default="./rbe", help="binary to benchmark")
+    parser.add_argument("--output", help="also append the results to this file (JSON lines)")
+    parser.add_argument("--baseline", help="results of an earlier run to compare against (JSON lines)")
+    parser.add_argument("--scenario", action="append", help="only run these scenarios")
+    parser.add_argument("--latency-requests", type=int, default=2000, help="requests timed one at a time")
+    options = parser.parse_args()
+
+    baseline = {}
+    if options.baseline:
+        for line in open(options.baseline):
+            if line.strip():
+                result = json.loads(line)
+                baseline[result["scenario"]] = result
+
+    commit = git_commit()
+    with tempfile.TemporaryDirectory() as directory:
+        for scenario in SCENARIOS:
+            if options.scenario and scenario[0] not in options.scenario:
+                continue
+            result = run_scenario(options.rbe, scenario, directory, options.latency_requests)
+            result["commit"] = commit
+            line = json.dumps(result)
+            print(line, flush=True)
+            if options.output:
+                with open(options.output, "a") as output:
+                    output.write(line + "\n")
+            if result["scenario"] in baseline:
+                print(compare(result, baseline[result["scenario"]]), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "batch.h"
+#include "cache.h"
+
+///////////////////////////////////////////
+// Private Functions
+
+// FNV-1a hash of a request together with its metric and direction
+uint64_t hashRequest(int metric, int direction, char* request, size_t requestLength){
+    uint64_t hash = 14695981039346656037ull;
+    hash = (hash ^ (uint64_t) (unsigned int) metric) * 1099511628211ull;
+    hash = (hash ^ (uint64_t) (direction < 0)) * 1099511628211ull;
+    for (size_t i=0; i<requestLength; i++){
+        hash ^= (unsigned char) request[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// bytes an entry counts against the byte limit
+size_t CacheEntry_size(CacheEntry* entry){
+    return sizeof(CacheEntry) + entry->requestLength + entry->resultLength;
+}
+
+// take an entry out of the recency list
+int Cache_unlink(Cache* instance, CacheEntry* entry){
+    if (entry->newer != NULL){
+        entry->newer->older = entry->older;
+    } else {
+        instance->newest = entry->older;
+    }
+    if (entry->older != NULL){
+        entry->older->newer = entry->newer;
+    } else {
+        instance->oldest = entry->newer;
+    }
+    return 0;
+}
+
+// put an entry at the front of the recency list
+int Cache_pushNewest(Cache* instance, CacheEntry* entry){
+    entry->newer = NULL;
+    entry->older = instance->newest;
+    if (instance->newest != NULL){
+        instance->newest->newer = entry;
+    } else {
+        instance->oldest = entry;
+    }
+    instance->newest = entry;
+    return 0;
+}
+
+// find the entry of a request (NULL = not cached)
+CacheEntry* Cache_find(Cache* instance, uint64_t hash, int metric, int direction, char* request, size_t requestLength){
+    CacheEntry* entry = instance->buckets[hash & (instance->numberOfBuckets - 1)];
+    while (entry != NULL){
+        if (entry->hash == hash && entry->metric == metric && entry->direction == direction
+            && entry->requestLength == requestLength && !memcmp(entry->request, request, requestLength)){
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+// remove the least recently used entry
+int Cache_evict(Cache* instance){
+    CacheEntry* entry = instance->oldest;
+    Cache_unlink(instance, entry);
+
+    CacheEntry** link = &instance->buckets[entry->hash & (instance->numberOfBuckets - 1)];
+    while (*link != entry){
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    instance->numberOfEntries--;
+    instance->bytes -= CacheEntry_size(entry);
+    instance->evictions++;
+
+    free(entry->request);
+    free(entry->result);
+    free(entry);
+    return 0;
+}
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new Cache that keeps at most maxEntries results and maxBytes bytes (0 = no byte limit)
+Cache* Cache_init(int maxEntries, size_t maxBytes){
+    Cache* result = (Cache*) malloc(sizeof(Cache));
+
+    result->maxEntries = maxEntries > 0 ? maxEntries : CACHE_DEFAULT_ENTRIES;
+    result->maxBytes = maxBytes;
+    result->numberOfEntries = 0;
+    result->bytes = 0;
+
+    // at most one entry per bucket on average
+    result->numberOfBuckets = 1;
+    while (result->numberOfBuckets < result->maxEntries){
+        result->numberOfBuckets *= 2;
+    }
+    result->buckets = (CacheEntry**) calloc(result->numberOfBuckets, sizeof(CacheEntry*));
+    result->newest = NULL;
+    result->oldest = NULL;
+
+    result->hits = 0;
+    result->misses = 0;
+    result->evictions = 0;
+
+    pthread_mutex_init(&result->lock, NULL);
+    return result;
+}
+
+// append the cached result of a request to output (returns 1 on a hit, 0 on a miss)
+int Cache_lookup(Cache* instance, int metric, int direction, char* request, size_t requestLength, OutputBuffer* output){
+    uint64_t hash = hashRequest(metric, direction, request, requestLength);
+
+    pthread_mutex_lock(&instance->lock);
+    CacheEntry* entry = Cache_find(instance, hash, metric, direction, request, requestLength);
+    if (entry == NULL){
+        instance->misses++;
+        pthread_mutex_unlock(&instance->lock);
+        return 0;
+    }
+    instance->hits++;
+    Cache_unlink(instance, entry);
+    Cache_pushNewest(instance, entry);
+    OutputBuffer_append(output, entry->result, entry->resultLength);
+    pthread_mutex_unlock(&instance->lock);
+
+    DBG("Cache hit (%zu bytes)\n", requestLength);
+    return 1;
+}
+
+// remember the result of a request, evicting the least recently used results to stay in the limits
+int Cache_insert(Cache* instance, int metric, int direction, char* request, size_t requestLength, char* result, size_t resultLength){
+    uint64_t hash = hashRequest(metric, direction, request, requestLength);
+
+    CacheEntry* entry = (CacheEntry*) malloc(sizeof(CacheEntry));
+    entry->hash = hash;
+    entry->metric = metric;
+    entry->direction = direction;
+    entry->requestLength = requestLength;
+    entry->resultLength = resultLength;
+
+    // results that could never fit are not cached
+    size_t size = CacheEntry_size(entry);
+    if (instance->maxBytes != 0 && size > instance->maxBytes){
+        free(entry);
+        return 0;
+    }
+
+    entry->request = (char*) malloc(requestLength + 1);
+    memcpy(entry->request, request, requestLength);
+    entry->result = (char*) malloc(resultLength + 1);
+    memcpy(entry->result, result, resultLength);
+
+    pthread_mutex_lock(&instance->lock);
+
+    // another thread may have cached the same request meanwhile
+    if (Cache_find(instance, hash, metric, direction, request, requestLength) != NULL){
+        pthread_mutex_unlock(&instance->lock);
+        free(entry->request);
+        free(entry->result);
+        free(entry);
+        return 0;
+    }
+
+    while (instance->numberOfEntries >= instance->maxEntries || (instance->maxBytes != 0 && instance->bytes + size > instance->maxBytes)){
+        Cache_evict(instance);
+    }
+
+    CacheEntry** bucket = &instance->buckets[hash & (instance->numberOfBuckets - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    Cache_pushNewest(instance, entry);
+    instance->numberOfEntries++;
+    instance->bytes += size;
+
+    pthread_mutex_unlock(&instance->lock);
+    return 0;
+}
+
+// print the hit, miss and eviction counts
+int Cache_report(Cache* instance, FILE* fp){
+    pthread_mutex_lock(&instance->lock);
+    fprintf(fp, "cache: %ld hits, %ld misses, %ld evictions, %d entries, %zu bytes\n", instance->hits, instance->misses, instance->evictions, instance->numberOfEntries, instance->bytes);
+    pthread_mutex_unlock(&instance->lock);
+    return 0;
+}
+
+// free a Cache and every result in it
+int Cache_free(Cache* instance){
+    while (instance->oldest != NULL){
+        Cache_evict(instance);
+    }
+    free(instance->buckets);
+    pthread_mutex_destroy(&instance->lock);
+    free(instance);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+
+#include "structures.h"
+
+// entries kept when only a byte limit is given
+#define CACHE_DEFAULT_ENTRIES 65536
+
+// initialize a new Cache that keeps at most maxEntries results and maxBytes bytes (0 = no byte limit)
+Cache* Cache_init(int maxEntries, size_t maxBytes);
+
+// append the cached result of a request to output (returns 1 on a hit, 0 on a miss)
+int Cache_lookup(Cache* instance, int metric, int direction, char* request, size_t requestLength, OutputBuffer* output);
+
+// remember the result of a request, evicting the least recently used results to stay in the limits
+int Cache_insert(Cache* instance, int metric, int direction, char* request, size_t requestLength, char* result, size_t resultLength);
+
+// print the hit, miss and eviction counts
+int Cache_report(Cache* instance, FILE* fp);
+
+// free a Cache and every result in it
+int Cache_free(Cache* instance);
+
+#endif
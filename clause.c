@@ -5,6 +5,11 @@
 #include "debug.h"
 #include "structures.h"
 
+#include "symbol.h"
+#include "sequence.h"
+#include "context.h"
+#include "arena.h"
+#include "stats.h"
 #include "clause.h"
 
 ///////////////////////////////////////////
@@ -207,13 +212,130 @@ int Clause_parse(Clause* instance, char* clauseString){
     DBG("Finshed parsing metrics (found %d)\n", numberOfMetrics);
 
     instance->numberOfTokens = numberOfTokens;
-    instance->tokens = tokens;
+    instance->tokenStrings = tokens;
+    instance->tokens = NULL;
     instance->numberOfMetrics = numberOfMetrics;
     instance->metrics = metrics;
 
     return 0;
 }
 
+// compile the repetition counts of a matcher into automaton states
+// each token index i gets one state per repetition count up to its cap
+// (maxRepetitions, or minRepetitions when unbounded since further repetitions behave the same)
+int Matcher_compileAutomaton(Matcher* instance, int numberOfTokens, Arena* arena){
+    instance->numberOfTokens = numberOfTokens;
+    instance->stateBase = (int*) Arena_alloc(arena, sizeof(int) * (numberOfTokens + 1));
+
+    int numberOfStates = 0;
+    for (int i=0; i<numberOfTokens; i++){
+        instance->stateBase[i] = numberOfStates;
+        int cap = instance->maxRepetitions[i];
+        if (cap == INT_MAX){
+            cap = instance->minRepetitions[i];
+        }
+        numberOfStates += cap + 1;
+    }
+    // match state
+    instance->stateBase[numberOfTokens] = numberOfStates;
+    numberOfStates++;
+
+    instance->numberOfStates = numberOfStates;
+    instance->stateTokens = (int*) Arena_alloc(arena, sizeof(int) * numberOfStates);
+    instance->stateRepetitions = (int*) Arena_alloc(arena, sizeof(int) * numberOfStates);
+    for (int i=0; i<=numberOfTokens; i++){
+        int end = (i < numberOfTokens) ? instance->stateBase[i+1] : numberOfStates;
+        for (int j=instance->stateBase[i]; j<end; j++){
+            instance->stateTokens[j] = i;
+            instance->stateRepetitions[j] = j - instance->stateBase[i];
+        }
+    }
+
+    int lastVariable = 0;
+    int bindsVariables = 0;
+    for (int i=0; i<numberOfTokens; i++){
+        if (instance->variableAccesses[i] != -1){
+            bindsVariables = 1;
+        }
+        if (instance->variableAccesses[i] > lastVariable){
+            lastVariable = instance->variableAccesses[i];
+        }
+    }
+    instance->numberOfVariables = lastVariable + 1;
+
+    // clauses without variables only need to know where each thread started
+    instance->captureSize = bindsVariables ? numberOfTokens + 1 : 1;
+
+    // gather the FIRST set from every token up to the first one that must be matched
+    instance->firstAny = 1;
+    instance->numberOfFirstTokens = 0;
+    int lastFirstToken = numberOfTokens;
+    for (int i=0; i<numberOfTokens; i++){
+        if (instance->matchingTokens[i] == NULL){
+            instance->firstAny = 1;
+            lastFirstToken = i;
+            break;
+        }
+        instance->numberOfFirstTokens += instance->numberOfMatchingTokens[i];
+        if (instance->minRepetitions[i] > 0){
+            instance->firstAny = 0;
+            lastFirstToken = i + 1;
+            break;
+        }
+    }
+    instance->firstTokens = (int*) Arena_alloc(arena, sizeof(int) * (instance->numberOfFirstTokens + 1));
+    int placementIndex = 0;
+    for (int i=0; i<lastFirstToken; i++){
+        for (int j=0; j<instance->numberOfMatchingTokens[i]; j++){
+            instance->firstTokens[placementIndex] = instance->matchingTokens[i][j];
+            placementIndex++;
+        }
+    }
+
+    DBG("Compiled automaton with %d states (capture size %d)\n", numberOfStates, instance->captureSize);
+    return 0;
+}
+
+// print one token of a clause in the database syntax (rebuilt from its matcher)
+int Clause_printToken(Matcher* matcher, int token, SymbolTable* symbols, FILE* fp){
+    if (matcher->matchingTokens[token] == NULL){
+        fprintf(fp, ".");
+    }
+    for (int i=0; i<matcher->numberOfMatchingTokens[token]; i++){
+        if (i){
+            fprintf(fp, "|");
+        }
+        // characters with a meaning in the syntax are escaped
+        for (char* c = SymbolTable_lookup(symbols, matcher->matchingTokens[token][i]); *c != '\0'; c++){
+            if (strchr(".+*|{$#\"\\", *c) != NULL){
+                fputc('\\', fp);
+            }
+            fputc(*c, fp);
+        }
+    }
+
+    int minimum = matcher->minRepetitions[token];
+    int maximum = matcher->maxRepetitions[token];
+    if (minimum == 0 && maximum == INT_MAX){
+        fprintf(fp, "*");
+    } else if (minimum == 1 && maximum == INT_MAX){
+        fprintf(fp, "+");
+    } else if (maximum == INT_MAX){
+        fprintf(fp, "{%d,}", minimum);
+    } else if (minimum != 1 || maximum != 1){
+        fprintf(fp, "{%d,%d}", minimum, maximum);
+    }
+
+    if (matcher->variableAccesses[token] != -1){
+        fprintf(fp, "$%d", matcher->variableAccesses[token]);
+    }
+    if (matcher->internalVariables[token] != -1){
+        fprintf(fp, "#%d", matcher->internalVariables[token]);
+    }
+    return 0;
+}
+
+
 ///////////////////////////////////////////
 // Public Functions
 
@@ -228,7 +350,7 @@ Clause* Clause_init(char* clauseString){
 
     DBG("Displaying Tokens and metrics:\n");
     for (int i=0; i<result->numberOfTokens; i++){
-        DBG("token: %s\n", result->tokens[i]);
+        DBG("token: %s\n", result->tokenStrings[i]);
     }
     for (int i=0; i<result->numberOfMetrics; i++){
         DBG("metric: %f\n", result->metrics[i]);
@@ -240,20 +362,37 @@ Clause* Clause_init(char* clauseString){
 }
 
 
-int Clause_createMatcher(Clause* instance){
-    Matcher* result = (Matcher*) malloc(sizeof(Matcher));
+// add a decoded symbol (NULL = end of a token's symbols) to the symbols waiting to be interned
+int Clause_addSymbolString(Clause* instance, char* symbol, int* capacity){
+    if (instance->numberOfSymbolStrings == *capacity){
+        *capacity = *capacity ? *capacity * 2 : 16;
+        instance->symbolStrings = (char**) realloc(instance->symbolStrings, sizeof(char*) * *capacity);
+    }
+    instance->symbolStrings[instance->numberOfSymbolStrings] = symbol;
+    instance->numberOfSymbolStrings++;
+    return 0;
+}
 
-    result->minRepetitions = (int*) malloc(sizeof(int) * instance->numberOfTokens);
-    result->maxRepetitions = (int*) malloc(sizeof(int) * instance->numberOfTokens);
-    result->variableAccesses = (int*) malloc(sizeof(int) * instance->numberOfTokens);
-    result->internalVariables = (int*) malloc(sizeof(int) * instance->numberOfTokens);
-    result->numberOfMatchingTokens = (int*) malloc(sizeof(int) * instance->numberOfTokens); 
-    result->matchingTokens = (char***) malloc(sizeof(char**) * instance->numberOfTokens);
+// Parse the tokens of the Clause into a matcher (allocated from arena) without interning them
+// (touches nothing shared, so clauses can be parsed in parallel)
+int Clause_parseMatcher(Clause* instance, Arena* arena){
+    Matcher* result = (Matcher*) Arena_alloc(arena, sizeof(Matcher));
+
+    result->minRepetitions = (int*) Arena_alloc(arena, sizeof(int) * instance->numberOfTokens);
+    result->maxRepetitions = (int*) Arena_alloc(arena, sizeof(int) * instance->numberOfTokens);
+    result->variableAccesses = (int*) Arena_alloc(arena, sizeof(int) * instance->numberOfTokens);
+    result->internalVariables = (int*) Arena_alloc(arena, sizeof(int) * instance->numberOfTokens);
+    result->numberOfMatchingTokens = (int*) Arena_alloc(arena, sizeof(int) * instance->numberOfTokens);
+    result->matchingTokens = (int**) Arena_alloc(arena, sizeof(int*) * instance->numberOfTokens);
+    instance->tokens = (int*) Arena_alloc(arena, sizeof(int) * instance->numberOfTokens);
+    instance->numberOfSymbolStrings = 0;
+    instance->symbolStrings = NULL;
+    int symbolCapacity = 0;
 
     DBG("Creating Matcher...\n");
     for (int i=0; i<instance->numberOfTokens; i++){
 
-        char* currentToken = instance->tokens[i];
+        char* currentToken = instance->tokenStrings[i];
         DBG("checking token: %s\n", currentToken);
 
         result->minRepetitions[i] = 1;
@@ -270,7 +409,6 @@ int Clause_createMatcher(Clause* instance){
         char* newToken = (char*) malloc(sizeof(char) * (tokenLength+1));
 
         int numberOfMatchingTokens = 0;
-        char** matchingTokens = NULL;
 
         int anyAllowed = 0;
 
@@ -332,7 +470,7 @@ int Clause_createMatcher(Clause* instance){
                         while (currentToken[k] != '\0'){
                             if (currentToken[k] == ','){
                                 currentToken[k] = '\0';
-                                result->minRepetitions[i] = atoi(currentToken+j);
+                                result->minRepetitions[i] = atoi(currentToken+j+1);
                                 commaIndex = k+1;
                             } else if (currentToken[k] == '}'){
                                 currentToken[k] = '\0';
@@ -342,7 +480,8 @@ int Clause_createMatcher(Clause* instance){
                             }
                             k++;
                         }
-                        j = k;
+                        // the loop increments j past the closing brace
+                        j = k - 1;
                     } else {
                         newToken[placementIndex] = currentToken[j];
                         placementIndex++;
@@ -351,9 +490,8 @@ int Clause_createMatcher(Clause* instance){
                 case '|':
                     if (backslashes % 2 == 0){
                         numberOfMatchingTokens++;
-                        matchingTokens = realloc(matchingTokens, sizeof(char*) * numberOfMatchingTokens);
-                        matchingTokens[numberOfMatchingTokens-1] = newToken;
-                        newToken[0] = '\0';
+                        newToken[placementIndex] = '\0';
+                        Clause_addSymbolString(instance, strdup(newToken), &symbolCapacity);
                         placementIndex = 0;
                     } else {
                         newToken[placementIndex] = currentToken[j];
@@ -386,44 +524,86 @@ int Clause_createMatcher(Clause* instance){
         }
         newToken[placementIndex] = '\0';
 
-
-
-        free(instance->tokens[i]);
-        instance->tokens[i] = newToken;
+        // the token itself ends its alternatives
+        DBG("\tnewToken: %s\n", newToken);
+        Clause_addSymbolString(instance, newToken, &symbolCapacity);
+        Clause_addSymbolString(instance, NULL, &symbolCapacity);
+        free(instance->tokenStrings[i]);
 
         if (!anyAllowed){
             numberOfMatchingTokens++;
-            matchingTokens = realloc(matchingTokens, sizeof(char*) * numberOfMatchingTokens);
-            matchingTokens[numberOfMatchingTokens-1] = newToken;
         }
 
+        // the ids are filled in once the symbols are interned
         result->numberOfMatchingTokens[i] = numberOfMatchingTokens;
-        result->matchingTokens[i] = matchingTokens;
+        result->matchingTokens[i] = NULL;
+        if (numberOfMatchingTokens > 0){
+            result->matchingTokens[i] = (int*) Arena_alloc(arena, sizeof(int) * numberOfMatchingTokens);
+        }
 
         DBG("\tminRepetitions = %d\n\tmaxRepetitions = %d\n\tvariableAccesses = %d\n\tinternalVariables = %d\n\tnumberOfMatchingTokens = %d\n\tmatchingTokens = %p\n", result->minRepetitions[i], result->maxRepetitions[i], result->variableAccesses[i], result->internalVariables[i], result->numberOfMatchingTokens[i], result->matchingTokens[i]);
-        DBG("\tnewToken: %s\n", newToken);
     }
 
+    free(instance->tokenStrings);
+    instance->tokenStrings = NULL;
 
     instance->matcher = result;
     return 0;
 }
 
+// Intern the symbols of a parsed matcher in order
+// (must not run in parallel with anything else interning into symbols)
+int Clause_internMatcher(Clause* instance, SymbolTable* symbols){
+    Matcher* matcher = instance->matcher;
+    int k = 0;
+    for (int i=0; i<instance->numberOfTokens; i++){
+        // alternatives from |
+        int j = 0;
+        while (instance->symbolStrings[k+1] != NULL){
+            matcher->matchingTokens[i][j] = SymbolTable_intern(symbols, instance->symbolStrings[k]);
+            free(instance->symbolStrings[k]);
+            j++;
+            k++;
+        }
+
+        // the token itself (also matched unless it is Any)
+        instance->tokens[i] = SymbolTable_intern(symbols, instance->symbolStrings[k]);
+        free(instance->symbolStrings[k]);
+        if (j < matcher->numberOfMatchingTokens[i]){
+            matcher->matchingTokens[i][j] = instance->tokens[i];
+        }
+        k += 2;
+    }
+
+    free(instance->symbolStrings);
+    instance->symbolStrings = NULL;
+    instance->numberOfSymbolStrings = 0;
+    return 0;
+}
+
+// Compile an interned matcher into an automaton (allocated from arena)
+// (touches nothing shared, so clauses can be compiled in parallel)
+int Clause_compileMatcher(Clause* instance, Arena* arena){
+    Matcher_compileAutomaton(instance->matcher, instance->numberOfTokens, arena);
+    return 0;
+}
+
+
 
 // TODO: THESE ARE THE MOST PERFORMANCE CRITICAL FUNCTIONS
     // it would be good to come back later and make it more efficient
 
-int tokenMatches(Matcher* matcher, char* token, int currentRepetition){
+int tokenMatches(Matcher* matcher, int token, int currentRepetition){
     DBG("Checking token match...\n");
     DBG("\t%d matching tokens\n", matcher->numberOfMatchingTokens[currentRepetition]);
-    DBG("\ttoken to match: %s\n", token);
+    DBG("\ttoken to match: %d\n", token);
     if (matcher->matchingTokens[currentRepetition] == NULL || matcher->numberOfMatchingTokens[currentRepetition] == 0){
         DBG("TOKEN MATCHES (ANY)\n");
         return 1;
     }
 
     for (int i=0; i<matcher->numberOfMatchingTokens[currentRepetition]; i++){
-        if (!strcmp(matcher->matchingTokens[currentRepetition][i], token)){
+        if (matcher->matchingTokens[currentRepetition][i] == token){
             DBG("TOKEN MATCHES\n");
             return 1;
         }
@@ -433,140 +613,196 @@ int tokenMatches(Matcher* matcher, char* token, int currentRepetition){
     return 0;
 }
 
-// Attempt to match to the start of the given tokens
-MatchResult* Clause_matchHelper(Clause* instance, char** tokens, int numberOfTokens){
-    int currentRepetition = 0;
-    int* repetitions = (int*) malloc(sizeof(int) * instance->numberOfTokens);
-    for (int i=0; i<instance->numberOfTokens; i++){
-        repetitions[i] = 0;
+// check if a match can start with this token
+int firstMatches(Matcher* matcher, int token){
+    if (matcher->firstAny){
+        return 1;
+    }
+    for (int i=0; i<matcher->numberOfFirstTokens; i++){
+        if (matcher->firstTokens[i] == token){
+            return 1;
+        }
     }
+    return 0;
+}
 
-    int latestToken = 0;
+// Add a thread in the given state to the end of a list,
+// following every transition that does not consume a token.
+// Moving on to the next token is tried before repeating the current one,
+// so threads are ordered the same way the old backtracking search tried them.
+void addThread(Matcher* matcher, ThreadList* list, int* visited, int stamp, int state, int* captures, int position){
+    if (visited[state] == stamp){
+        return;
+    }
+    visited[state] = stamp;
+
+    int currentToken = matcher->stateTokens[state];
+    int repetitions = matcher->stateRepetitions[state];
+
+    int canConsume = currentToken < matcher->numberOfTokens && repetitions < matcher->maxRepetitions[currentToken];
+    if (currentToken < matcher->numberOfTokens && repetitions >= matcher->minRepetitions[currentToken]){
+        // the next token starts here
+        int saved = 0;
+        if (currentToken + 1 < matcher->captureSize){
+            saved = captures[currentToken+1];
+            captures[currentToken+1] = position;
+        }
+        addThread(matcher, list, visited, stamp, matcher->stateBase[currentToken+1], captures, position);
+        if (currentToken + 1 < matcher->captureSize){
+            captures[currentToken+1] = saved;
+        }
+    } else {
+        // the match state and tokens below their minimum stay on the list
+        canConsume = 1;
+    }
 
+    if (canConsume){
+        int index = list->numberOfThreads;
+        list->states[index] = state;
+        memcpy(list->captures + index * matcher->captureSize, captures, sizeof(int) * matcher->captureSize);
+        list->numberOfThreads++;
+    }
+}
+
+// Build the MatchResult for a finished thread
+MatchResult* createMatchResult(Clause* instance, Sequence* tokens, int* captures, int end, Arena* arena){
     Matcher* matcher = instance->matcher;
 
-    int wentBack;
-
-    while (1){
-        // if child fails, increment parent, then check
-        DBG("Matching until reaching min repetitions %d (%d)...\n", currentRepetition, matcher->minRepetitions[currentRepetition]);
-        DBG("latestToken: %d\n", latestToken);
-        while (repetitions[currentRepetition] < matcher->minRepetitions[currentRepetition]){
-            do {
-                DBG("latestToken: %d\tnumberOfTokens: %d\n", latestToken, numberOfTokens);
-                if (latestToken < numberOfTokens){
-                    DBG("tokenMatches(matcher, %s, %d)\n", tokens[latestToken], currentRepetition);
-                }
-                wentBack = 0;
-                if (latestToken >= numberOfTokens || !tokenMatches(matcher, tokens[latestToken], currentRepetition)){
-                    DBG("Going back to the previous repetition...\n");
+    MatchResult* result = (MatchResult*) Arena_alloc(arena, sizeof(MatchResult));
+    result->offset = captures[0];
+    result->length = end - captures[0];
 
-                    latestToken -= repetitions[currentRepetition];
-                    repetitions[currentRepetition] = 0;
-                    currentRepetition--;
+    result->numberOfVariables = matcher->numberOfVariables;
+    result->variableBindingLengths = (int*) Arena_alloc(arena, sizeof(int) * result->numberOfVariables);
+    result->variableBindings = (int**) Arena_alloc(arena, sizeof(int*) * result->numberOfVariables);
 
-                    wentBack = 1;
+    for (int i=0; i<result->numberOfVariables; i++){
+        result->variableBindingLengths[i] = -1;
+    }
 
-                    if (currentRepetition < 0){
-                        DBG("No matches possible %d\n", currentRepetition);
-                        return NULL;
-                    }
-                } 
-                if (wentBack){
-                    DBG("We went back. Reevalutating...\n");
-                } else {
-                    DBG("We did not go back.\n");
-                    repetitions[currentRepetition]++;
-                    latestToken++;
-                    DBG("This token's repetitions++ %d (%d)\n", currentRepetition, repetitions[currentRepetition]);
-                    if (repetitions[currentRepetition] > matcher->maxRepetitions[currentRepetition]){
-                        DBG("Too many repetitions. Going back %d (%d)", currentRepetition, matcher->maxRepetitions[currentRepetition]);
-                        // too many repetitions. go back
-                        latestToken -= repetitions[currentRepetition];
-                        repetitions[currentRepetition] = 0;
-                        currentRepetition--;
-
-                        wentBack = 1;
-
-                        if (currentRepetition < 0){
-                            DBG("No matches possible %d\n", currentRepetition);
-                            return NULL;
-                        }
-                    }
-                }
-            } while (wentBack);
-        }
-        DBG("Made it to the minimum number of repetitions %d (%d)...\n", currentRepetition, matcher->minRepetitions[currentRepetition]);
-
-        // we have made it to the minimum. go to the child and restart the process for it
-        DBG("Moving to child...\n");
-        currentRepetition++;
-        DBG("Child index: %d\tNumber of tokens: %d\n", currentRepetition, numberOfTokens);
-        if (currentRepetition >= instance->numberOfTokens){
-            DBG("Reached a match...\n");
-            MatchResult* result = (MatchResult*) malloc(sizeof(MatchResult));
-            result->length = latestToken;
-
-            int lastVariable = 0;
-            for (int i=0; i<numberOfTokens; i++){
-                if (matcher->variableAccesses[i] > lastVariable){
-                    lastVariable = matcher->variableAccesses[i];
-                }
+    if (matcher->captureSize == 1){
+        return result;
+    }
+
+    DBG("Binding variables...\n")
+    for (int i=0; i<instance->numberOfTokens; i++){
+        int repetitions = captures[i+1] - captures[i];
+        if (matcher->variableAccesses[i] != -1 && repetitions > 0){
+            DBG("Found variable (%d) that needs binding (index = %d, repetitions = %d, matchOffset = %d)...\n", matcher->variableAccesses[i], i, repetitions, captures[i]);
+            result->variableBindingLengths[matcher->variableAccesses[i]] = repetitions;
+            result->variableBindings[matcher->variableAccesses[i]] = (int*) Arena_alloc(arena, sizeof(int) * repetitions);
+            for (int j=0; j<repetitions; j++){
+                result->variableBindings[matcher->variableAccesses[i]][j] = SEQUENCE_GET(tokens, captures[i]+j);
             }
+        }
+    }
 
-            result->numberOfVariables = lastVariable+1;
-            result->variableBindingLengths = (int*) malloc(sizeof(int) * result->numberOfVariables);
-            result->variableBindings = (char***) malloc(sizeof(char**) * result->numberOfVariables);
+    return result;
+}
 
-            for (int i=0; i<result->numberOfVariables; i++){
-                result->variableBindingLengths[i] = -1;
+// Attempt to match this clause to a Sequence of symbol ids
+// The clause's automaton is simulated over the tokens once (Pike VM),
+// starting a new thread at each offset until the leftmost match is found.
+// The result is allocated from the context's arena.
+// The offsets started at and the threads advanced are added to counters.
+// If no match is possible (or the request's deadline passes first), return NULL
+MatchResult* Clause_match(Clause* instance, Sequence* tokens, int startOffset, Context* context, ClauseCounters* counters){
+    DBG("Attempting to match clause to tokens...\n");
+    int numberOfTokens = SEQUENCE_LENGTH(tokens);
+    Matcher* matcher = instance->matcher;
+    int captureSize = matcher->captureSize;
+    int matchState = matcher->stateBase[instance->numberOfTokens];
+
+    // the scratch space of the context is large enough for any matcher
+    ThreadList* current = &context->threadLists[0];
+    ThreadList* next = &context->threadLists[1];
+    current->numberOfThreads = 0;
+    next->numberOfThreads = 0;
+
+    int* visited = context->visited;
+    for (int i=0; i<matcher->numberOfStates; i++){
+        visited[i] = -1;
+    }
+    int* captures = context->captures;
+    int* matchCaptures = context->matchCaptures;
+    int matchEnd = -1;
+
+    long offsets = 0;
+    long steps = 0;
+
+    for (int position=startOffset; position<=numberOfTokens; position++){
+        // the request ran out of time (a match found so far is still used)
+        if (CONTEXT_EXPIRED(context)){
+            break;
+        }
+
+        // start a new attempt at this offset with the lowest priority
+        if (matchEnd == -1 && position < numberOfTokens && firstMatches(matcher, SEQUENCE_GET(tokens, position))){
+            captures[0] = position;
+            addThread(matcher, current, visited, position, matcher->stateBase[0], captures, position);
+            offsets++;
+        }
+
+        if (current->numberOfThreads == 0 && matchEnd != -1){
+            break;
+        }
+
+        steps += current->numberOfThreads;
+        next->numberOfThreads = 0;
+        for (int i=0; i<current->numberOfThreads; i++){
+            int state = current->states[i];
+            int* threadCaptures = current->captures + i * captureSize;
+
+            if (state == matchState){
+                // lower priority threads can no longer win
+                DBG("Found a match ending at %d\n", position);
+                matchEnd = position;
+                memcpy(matchCaptures, threadCaptures, sizeof(int) * captureSize);
+                break;
             }
 
-            DBG("Binding variables...\n")
-            int matchOffset = 0;
-            for (int i=0; i<instance->numberOfTokens; i++){
-                if (matcher->variableAccesses[i] != -1 && repetitions[i] > 0){
-                    DBG("Found variable (%d) that needs binding (index = %d, repetitions = %d, matchOffset = %d)...\n", matcher->variableAccesses[i], i, repetitions[i], matchOffset);
-                    result->variableBindingLengths[matcher->variableAccesses[i]] = repetitions[i];
-                    result->variableBindings[matcher->variableAccesses[i]] = (char**) malloc(sizeof(char*) * repetitions[i]);
-                    DBG("Saving the binding...\n");
-                    for (int j=0; j<repetitions[i]; j++){
-                        DBG("Added %s to binding.\n", instance->tokens[matchOffset+j]);
-                        result->variableBindings[matcher->variableAccesses[i]][j] = tokens[matchOffset+j];
-                    }
+            if (position < numberOfTokens && tokenMatches(matcher, SEQUENCE_GET(tokens, position), matcher->stateTokens[state])){
+                // the last state of an unbounded token repeats into itself
+                int nextState = state;
+                if (state + 1 < matcher->stateBase[matcher->stateTokens[state]+1]){
+                    nextState = state + 1;
                 }
-                matchOffset += repetitions[i];
+                addThread(matcher, next, visited, position+1, nextState, threadCaptures, position+1);
             }
-
-            return result;
         }
-        
+
+        ThreadList* temp = current;
+        current = next;
+        next = temp;
+    }
+
+    MatchResult* result = NULL;
+    if (matchEnd != -1){
+        DBG("This clause has a match...\n");
+        result = createMatchResult(instance, tokens, matchCaptures, matchEnd, context->arena);
     }
 
-    free(repetitions);
-    return NULL;
+    COUNTER_ADD(counters->offsets, offsets);
+    COUNTER_ADD(counters->steps, steps);
+    return result;
 }
 
-// Attempt to match this clause to an array of strings
-// If no match is possible, return NULL
-MatchResult* Clause_match(Clause* instance, char** tokens, int numberOfTokens, int startOffset){
-    DBG("Attempting to match clause to tokens...\n");
-    // perform pattern matching using the Matcher
-    MatchResult* result;
-
-    // for a match to happen, every one of the matcher's tokens should match with the input
-    for (int i=startOffset; i<numberOfTokens; i++){
-        DBG("Attempt at offset %d (length = %d)\n", i, numberOfTokens-i);
-        result = Clause_matchHelper(instance, tokens+i, numberOfTokens-i);
-        if (result != NULL){
-            DBG("This clause has a match...\n");
-            result->offset = i;
-            return result;
+
+// print the tokens of a compiled clause in the database syntax (without quotes or metrics)
+int Clause_print(Clause* instance, SymbolTable* symbols, FILE* fp){
+    for (int i=0; i<instance->numberOfTokens; i++){
+        if (i){
+            fprintf(fp, " ");
         }
+        Clause_printToken(instance->matcher, i, symbols, fp);
     }
-
-
-    return NULL;
+    return 0;
 }
 
-
+// free a Clause (its matcher lives in the arena it was created from)
+int Clause_free(Clause* instance){
+    free(instance->tokenStrings);
+    free(instance->metrics);
+    free(instance);
+    return 0;
+}
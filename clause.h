@@ -1,15 +1,31 @@
 #ifndef CLAUSE_H
 #define CLAUSE_H
 
+#include <stdio.h>
+
 #include "structures.h"
 
 // initialize a new Rule
 Clause* Clause_init(char* clauseString);
 
-// Create a matcher for the Clause 
-int Clause_createMatcher(Clause* instance);
+// A matcher is created in three steps so parsing and compiling can run in parallel
+// while interning stays in clause order.
+// Parse the tokens of the Clause into a matcher (allocated from arena) without interning them
+int Clause_parseMatcher(Clause* instance, Arena* arena);
+
+// Intern the symbols of a parsed matcher
+int Clause_internMatcher(Clause* instance, SymbolTable* symbols);
+
+// Compile an interned matcher into an automaton (allocated from arena)
+int Clause_compileMatcher(Clause* instance, Arena* arena);
+
+// Attempt to match tokens to this clause (adding the work done to counters)
+MatchResult* Clause_match(Clause* instance, Sequence* tokens, int startOffset, Context* context, ClauseCounters* counters);
+
+// print the tokens of a compiled clause in the database syntax (without quotes or metrics)
+int Clause_print(Clause* instance, SymbolTable* symbols, FILE* fp);
 
-// Attempt to match tokens to this clause
-MatchResult* Clause_match(Clause* instance, char** tokens, int numberOfTokens, int startOffset);
+// free a Clause (its matcher lives in the arena it was created from)
+int Clause_free(Clause* instance);
 
 #endif
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "symbol.h"
+#include "arena.h"
+#include "memo.h"
+#include "trace.h"
+#include "history.h"
+#include "stats.h"
+#include "context.h"
+
+#define CONTEXT_ARENA_BLOCK_SIZE (64 * 1024)
+#define CONTEXT_MEMO_BUCKETS 256
+#define CONTEXT_TRACE_EVENTS 4096
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new Context for executing an Engine
+// the matcher scratch space is sized for the largest automaton of the engine
+Context* Context_init(Engine* engine){
+    Context* result = (Context*) malloc(sizeof(Context));
+
+    result->engine = engine;
+    result->internalVariable = 0;
+    result->cache = NULL;
+    result->symbols = SymbolTable_init();
+    result->inputCapacity = 0;
+    result->inputTokens = NULL;
+
+    result->arena = Arena_init(CONTEXT_ARENA_BLOCK_SIZE);
+    result->candidates = (char*) malloc(sizeof(char) * (engine->dispatch->numberOfClauses + 1));
+    memset(result->presentTokens, 0, sizeof(uint64_t) * DISPATCH_FILTER_WORDS);
+
+    result->memo = NULL;
+    result->segmentCapacity = 0;
+    result->segmentStarts = NULL;
+    result->segmentPairs = NULL;
+    if (engine->numberOfBracketPairs > 0){
+        result->memo = Memo_init(CONTEXT_MEMO_BUCKETS);
+    }
+
+    for (int i=0; i<2; i++){
+        result->threadLists[i].numberOfThreads = 0;
+        result->threadLists[i].states = (int*) malloc(sizeof(int) * engine->largestAutomaton);
+        result->threadLists[i].captures = (int*) malloc(sizeof(int) * engine->largestAutomaton * engine->largestCaptureSize);
+    }
+    result->visited = (int*) malloc(sizeof(int) * engine->largestAutomaton);
+    result->captures = (int*) malloc(sizeof(int) * engine->largestCaptureSize);
+    result->matchCaptures = (int*) malloc(sizeof(int) * engine->largestCaptureSize);
+
+    result->numberOfExecutions = 0;
+    result->numberOfPasses = 0;
+    result->numberOfSubstitutions = 0;
+    result->pass = 0;
+    result->numberOfCycles = 0;
+    result->ruleCycles = (long*) calloc(engine->numberOfCompiledRules + 1, sizeof(long));
+    result->clauseCounters = (ClauseCounters*) calloc(engine->dispatch->numberOfClauses + 1, sizeof(ClauseCounters));
+    result->histograms = (RequestHistograms*) calloc(1, sizeof(RequestHistograms));
+    result->history = History_init();
+
+    result->limits = engine->limits;
+    result->numberOfPartials = 0;
+    result->stopped = 0;
+    result->deadline = 0;
+    result->passesLeft = -1;
+    result->substitutionsLeft = -1;
+
+    result->tracing = 0;
+    result->trace = NULL;
+
+    return result;
+}
+
+// get the id of a token of the current request (length bytes of the request, not terminated)
+// tokens the engine has never seen are interned in the Context so the engine stays read only
+int Context_intern(Context* instance, char* token, size_t length){
+    int id = SymbolTable_findRange(instance->engine->symbols, token, length);
+    if (id != -1){
+        return id;
+    }
+    return instance->engine->symbols->numberOfSymbols + SymbolTable_internRange(instance->symbols, token, length);
+}
+
+// get the string for a symbol id of the current request
+char* Context_lookup(Context* instance, int id){
+    int numberOfSymbols = instance->engine->symbols->numberOfSymbols;
+    if (id < numberOfSymbols){
+        return SymbolTable_lookup(instance->engine->symbols, id);
+    }
+    return SymbolTable_lookup(instance->symbols, id - numberOfSymbols);
+}
+
+// get the length in bytes of the string for a symbol id of the current request
+size_t Context_lookupLength(Context* instance, int id){
+    int numberOfSymbols = instance->engine->symbols->numberOfSymbols;
+    if (id < numberOfSymbols){
+        return SymbolTable_lookupLength(instance->engine->symbols, id);
+    }
+    return SymbolTable_lookupLength(instance->symbols, id - numberOfSymbols);
+}
+
+// forget the tokens of the previous request
+int Context_clearSymbols(Context* instance){
+    return SymbolTable_clear(instance->symbols);
+}
+
+// record the substitutions of the following requests in the Context's trace (or stop recording them)
+int Context_setTracing(Context* instance, int tracing){
+    if (tracing && instance->trace == NULL){
+        instance->trace = Trace_init(CONTEXT_TRACE_EVENTS);
+    }
+    instance->tracing = tracing;
+    return 0;
+}
+
+// start the limits of a new request from instance->limits
+int Context_startLimits(Context* instance){
+    instance->stopped = 0;
+    instance->deadline = instance->limits.nanoseconds > 0 ? Stats_now() + instance->limits.nanoseconds : 0;
+    instance->deadlineCountdown = CONTEXT_DEADLINE_INTERVAL;
+    instance->passesLeft = instance->limits.passes > 0 ? instance->limits.passes : -1;
+    instance->substitutionsLeft = instance->limits.substitutions > 0 ? instance->limits.substitutions : -1;
+    return 0;
+}
+
+// read the clock for CONTEXT_EXPIRED (stops the request once its deadline passed)
+int Context_checkDeadline(Context* instance){
+    instance->deadlineCountdown = CONTEXT_DEADLINE_INTERVAL;
+    if (Stats_now() >= instance->deadline){
+        instance->stopped = LIMIT_DEADLINE;
+        // nothing needs the clock anymore
+        instance->deadline = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// free a Context
+int Context_free(Context* instance){
+    SymbolTable_free(instance->symbols);
+    free(instance->inputTokens);
+    Arena_free(instance->arena);
+    free(instance->candidates);
+    free(instance->clauseCounters);
+    free(instance->histograms);
+    free(instance->ruleCycles);
+    History_free(instance->history);
+    if (instance->trace != NULL){
+        Trace_free(instance->trace);
+    }
+    if (instance->memo != NULL){
+        Memo_free(instance->memo);
+    }
+    free(instance->segmentStarts);
+    free(instance->segmentPairs);
+    for (int i=0; i<2; i++){
+        free(instance->threadLists[i].states);
+        free(instance->threadLists[i].captures);
+    }
+    free(instance->visited);
+    free(instance->captures);
+    free(instance->matchCaptures);
+    free(instance);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stddef.h>
+
+#include "structures.h"
+
+// why a request stopped before reaching a fixpoint (Context->stopped)
+#define LIMIT_DEADLINE 1
+#define LIMIT_PASSES 2
+#define LIMIT_SUBSTITUTIONS 3
+
+// the clock is read once every this many CONTEXT_EXPIRED checks
+#define CONTEXT_DEADLINE_INTERVAL 256
+
+// whether the deadline of the current request has passed (cheap enough for the inner loops of matching)
+#define CONTEXT_EXPIRED(context) ((context)->deadline != 0 && --(context)->deadlineCountdown <= 0 && Context_checkDeadline(context))
+
+// initialize a new Context for executing an Engine
+Context* Context_init(Engine* engine);
+
+// get the id of a token of the current request (length bytes of the request, not terminated)
+// tokens the engine has never seen are interned in the Context so the engine stays read only
+int Context_intern(Context* instance, char* token, size_t length);
+
+// get the string for a symbol id of the current request
+char* Context_lookup(Context* instance, int id);
+
+// get the length in bytes of the string for a symbol id of the current request
+size_t Context_lookupLength(Context* instance, int id);
+
+// forget the tokens of the previous request
+int Context_clearSymbols(Context* instance);
+
+// record the substitutions of the following requests in the Context's trace (or stop recording them)
+int Context_setTracing(Context* instance, int tracing);
+
+// start the limits of a new request from instance->limits
+int Context_startLimits(Context* instance);
+
+// read the clock for CONTEXT_EXPIRED (stops the request once its deadline passed)
+int Context_checkDeadline(Context* instance);
+
+// free a Context
+int Context_free(Context* instance);
+
+#endif
@@ -1,5 +1,6 @@
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "debug.h"
 #include "structures.h"
@@ -29,22 +30,93 @@ char* getFileString(FILE* fp, int* fileLength){
     return fileString;
 }
 
-// Given a Database instance and file pointer, 
-// parse the file into an array of Rules
-// and update the instance accordingly
-int Database_parse(Database* instance, FILE* fp){
-    DBG("Parsing Database File...\n");
+// check whether a section of a database file is a declaration instead of a rule
+// (the first thing after spaces and comments is @<name>)
+char* getDeclaration(char* section, char* name){
+    int i = 0;
+    while (section[i] != '\0'){
+        if (section[i] == '#'){
+            while (section[i] != '\0' && section[i] != '\n'){
+                i++;
+            }
+        } else if (section[i] == ' ' || section[i] == '\t' || section[i] == '\n' || section[i] == '\r'){
+            i++;
+        } else {
+            break;
+        }
+    }
+    int n = strlen(name);
+    if (section[i] == '@' && !strncmp(section+i+1, name, n)){
+        return section + i + 1 + n;
+    }
+    return NULL;
+}
+
+// parse a declaration of bracket pairs: @brackets "<open1>" "<close1>" "<open2>" "<close2>" ...
+int Database_parseBrackets(Database* instance, char* declaration){
+    int n = strlen(declaration);
+    int quotes = 0;
+    int backslashes = 0;
+    char* token = (char*) malloc(sizeof(char) * (n + 1));
+    int placementIndex = 0;
+    // pairs add to the ones declared before
+    int numberOfTokens = instance->numberOfBracketPairs * 2;
+    int firstToken = numberOfTokens;
+    for (int i=0; i<n; i++){
+        char c = declaration[i];
+        if (c == '\\' && quotes){
+            backslashes++;
+            if (backslashes % 2 == 0){
+                token[placementIndex] = c;
+                placementIndex++;
+            }
+            continue;
+        }
+        if (c == '"' && backslashes % 2 == 0){
+            quotes ^= 1;
+            if (!quotes){
+                token[placementIndex] = '\0';
+                instance->brackets = realloc(instance->brackets, sizeof(char*) * (numberOfTokens + 1));
+                instance->brackets[numberOfTokens] = strdup(token);
+                numberOfTokens++;
+            }
+            placementIndex = 0;
+        } else if (quotes){
+            token[placementIndex] = c;
+            placementIndex++;
+        } else if (c == '#'){
+            while (i < n && declaration[i] != '\n'){
+                i++;
+            }
+        }
+        backslashes = 0;
+    }
+    free(token);
+
+    if ((numberOfTokens - firstToken) % 2 != 0){
+        PANIC("ERROR: @brackets needs an open and a close token for every pair\n");
+    }
+    instance->numberOfBracketPairs = numberOfTokens / 2;
+    DBG("Declared %d bracket pairs\n", instance->numberOfBracketPairs);
+    return 0;
+}
+
+// Given a Database instance and the contents of a database file (owned by the Database from now on),
+// split the file at top level semicolons into rule strings
+// (the rules are parsed separately so they can be parsed in parallel)
+int Database_split(Database* instance, char* fileString, int fileLength){
+    DBG("Splitting Database File...\n");
 
     int numberOfRules = 0;
-    Rule** rules = NULL;
+    int capacity = 0;
+    char** ruleStrings = NULL;
+    instance->numberOfBracketPairs = 0;
+    instance->brackets = NULL;
 
-    // get file contents
-    int fileLength;
-    char* fileString = getFileString(fp, &fileLength);
     DBG("File contents:\n");
     DBG("%s\n", fileString);
 
-    // separate the file at semicolons and parse each section as a rule
+    // separate the file at semicolons and keep each section as a rule
     int ruleStart = 0;
     int insideRule = 0;
     int insideComment = 0;
@@ -60,9 +132,17 @@ int Database_parse(Database* instance, FILE* fp){
             backslashes++;
         } else if (fileString[i] == ';' && !insideRule){
             fileString[i] = '\0';
-            numberOfRules++;
-            rules = realloc(rules, sizeof(Rule*) * numberOfRules);
-            rules[numberOfRules-1] = Rule_init(fileString+ruleStart);
+            char* declaration = getDeclaration(fileString+ruleStart, "brackets");
+            if (declaration != NULL){
+                Database_parseBrackets(instance, declaration);
+            } else {
+                if (numberOfRules == capacity){
+                    capacity = capacity ? capacity * 2 : 64;
+                    ruleStrings = realloc(ruleStrings, sizeof(char*) * capacity);
+                }
+                ruleStrings[numberOfRules] = fileString+ruleStart;
+                numberOfRules++;
+            }
             ruleStart = i + 1;
         }
 
@@ -72,12 +152,11 @@ int Database_parse(Database* instance, FILE* fp){
     }
 
     instance->numberOfRules = numberOfRules;
-    instance->rules = rules;
+    instance->rules = (Rule**) malloc(sizeof(Rule*) * (numberOfRules + 1));
+    instance->fileString = fileString;
+    instance->ruleStrings = ruleStrings;
 
-    // memory cleanup
-    free(fileString);
-
-    DBG("Finished Parsing Database File...\n");
+    DBG("Finished Splitting Database File (%d rules)...\n", numberOfRules);
     return 0;
 }
 
@@ -85,8 +164,8 @@ int Database_parse(Database* instance, FILE* fp){
 ///////////////////////////////////////////////////
 // Public Functions
 
-// initialize a new Engine
-Database* Database_init(char* filename){
+// read a database file and find its rules without parsing them
+Database* Database_read(char* filename){
     Database* result = malloc(sizeof(Database));
 
     DBG("Opening database file: %s\n", filename);
@@ -100,15 +179,65 @@ Database* Database_init(char* filename){
 
     DBG("File opened successfully.\n");
 
-    // parse the database file into an array of rules
-    Database_parse(result, fp);
+    // split the database file into rule strings
+    int fileLength;
+    char* fileString = getFileString(fp, &fileLength);
+    Database_split(result, fileString, fileLength);
 
     // memory cleanup
     fclose(fp);
 
-    DBG("Database fully initialized! (%d Rules)\n", result->numberOfRules);
+    return result;
+}
 
+// read a database from a string and find its rules without parsing them
+Database* Database_readString(char* text){
+    Database* result = malloc(sizeof(Database));
+    Database_split(result, strdup(text), strlen(text));
     return result;
 }
 
+// parse one rule of a Database that was read
+// (each rule only touches its own slot, so rules can be parsed in parallel)
+int Database_parseRule(Database* instance, int index){
+    instance->rules[index] = Rule_init(instance->ruleStrings[index]);
+    return 0;
+}
+
+// free the contents of a database file once every rule is parsed
+int Database_finish(Database* instance){
+    free(instance->fileString);
+    free(instance->ruleStrings);
+    instance->fileString = NULL;
+    instance->ruleStrings = NULL;
+
+    DBG("Database fully initialized! (%d Rules)\n", instance->numberOfRules);
+    return 0;
+}
+
+// free a Database and its rules
+int Database_free(Database* instance){
+    for (int i=0; i<instance->numberOfRules; i++){
+        Rule_free(instance->rules[i]);
+    }
+    free(instance->rules);
+    for (int i=0; i<2*instance->numberOfBracketPairs; i++){
+        free(instance->brackets[i]);
+    }
+    free(instance->brackets);
+    free(instance);
+    return 0;
+}
+
+// initialize a new Database
+Database* Database_init(char* filename){
+    Database* result = Database_read(filename);
 
+    // parse the database file into an array of rules
+    for (int i=0; i<result->numberOfRules; i++){
+        Database_parseRule(result, i);
+    }
+
+    Database_finish(result);
+    return result;
+}
@@ -6,5 +6,21 @@
 // initialize a new Database
 Database* Database_init(char* filename);
 
+// read a database file and find its rules without parsing them
+Database* Database_read(char* filename);
+
+// read a database from a string and find its rules without parsing them
+Database* Database_readString(char* text);
+
+// parse one rule of a Database that was read
+// (each rule only touches its own slot, so rules can be parsed in parallel)
+int Database_parseRule(Database* instance, int index);
+
+// free the contents of a database file once every rule is parsed
+int Database_finish(Database* instance);
+
+// free a Database and its rules
+int Database_free(Database* instance);
+
 
 #endif
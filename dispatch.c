@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "sequence.h"
+#include "dispatch.h"
+
+///////////////////////////////////////////
+// Private Functions
+
+// a symbol can appear more than once in a FIRST set (in several alternatives or optional tokens)
+// but a clause is only listed under it once
+int repeatsFirstToken(Matcher* matcher, int k){
+    for (int i=0; i<k; i++){
+        if (matcher->firstTokens[i] == matcher->firstTokens[k]){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A token of a matcher is literal if it must appear exactly once and has a single alternative
+int isLiteral(Matcher* matcher, int token){
+    return matcher->minRepetitions[token] == 1 && matcher->maxRepetitions[token] == 1
+        && matcher->matchingTokens[token] != NULL && matcher->numberOfMatchingTokens[token] == 1;
+}
+
+// A token of a matcher is required if every match contains it: it repeats at least once and has a single alternative
+int isRequired(Matcher* matcher, int token){
+    return matcher->minRepetitions[token] >= 1
+        && matcher->matchingTokens[token] != NULL && matcher->numberOfMatchingTokens[token] == 1;
+}
+
+// find the longest run of literal tokens in a matcher
+// returns the length of the run and sets runStart
+int longestLiteralRun(Matcher* matcher, int* runStart){
+    int bestLength = 0;
+    int currentLength = 0;
+    *runStart = 0;
+    for (int i=0; i<matcher->numberOfTokens; i++){
+        if (isLiteral(matcher, i)){
+            currentLength++;
+            if (currentLength > bestLength){
+                bestLength = currentLength;
+                *runStart = i - currentLength + 1;
+            }
+        } else {
+            currentLength = 0;
+        }
+    }
+    return bestLength;
+}
+
+// follow the goto function of a node (-1 = no edge)
+int Dispatch_edge(Dispatch* instance, int node, int symbol){
+    int low = instance->edgeStart[node];
+    int high = instance->edgeStart[node+1] - 1;
+    while (low <= high){
+        int middle = (low + high) / 2;
+        if (instance->edgeSymbols[middle] == symbol){
+            return instance->edgeTargets[middle];
+        } else if (instance->edgeSymbols[middle] < symbol){
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+int compareEdges(const void* a, const void* b){
+    return ((int*) a)[0] - ((int*) b)[0];
+}
+
+///////////////////////////////////////////
+// Public Functions
+
+// build the Dispatch for an array of compiled rules
+// every clause is keyed on its longest literal run (clauses without one are always candidates)
+// and the runs are combined into one Aho-Corasick automaton
+// every clause also gets a bloom filter of its required literals
+Dispatch* Dispatch_init(Rule** rules, int numberOfRules, int numberOfSymbols){
+    Dispatch* result = (Dispatch*) malloc(sizeof(Dispatch));
+
+    int numberOfClauses = 0;
+    for (int i=0; i<numberOfRules; i++){
+        numberOfClauses += rules[i]->numberOfClauses;
+    }
+    result->numberOfClauses = numberOfClauses;
+    result->presetMarks = (char*) malloc(sizeof(char) * numberOfClauses);
+    result->requiredLiterals = (uint64_t*) calloc((numberOfClauses + 1) * DISPATCH_FILTER_WORDS, sizeof(uint64_t));
+
+    // clauses are listed under every symbol of their FIRST set
+    result->numberOfSymbols = numberOfSymbols;
+    result->firstStart = (int*) calloc(numberOfSymbols + 1, sizeof(int));
+    for (int i=0; i<numberOfRules; i++){
+        for (int j=0; j<rules[i]->numberOfClauses; j++){
+            Matcher* matcher = rules[i]->clauses[j]->matcher;
+            if (!matcher->firstAny){
+                for (int k=0; k<matcher->numberOfFirstTokens; k++){
+                    if (!repeatsFirstToken(matcher, k)){
+                        result->firstStart[matcher->firstTokens[k]+1]++;
+                    }
+                }
+            }
+        }
+    }
+    for (int i=0; i<numberOfSymbols; i++){
+        result->firstStart[i+1] += result->firstStart[i];
+    }
+    result->firstClauses = (int*) malloc(sizeof(int) * (result->firstStart[numberOfSymbols] + 1));
+    int* firstPlacement = (int*) malloc(sizeof(int) * (numberOfSymbols + 1));
+    memcpy(firstPlacement, result->firstStart, sizeof(int) * (numberOfSymbols + 1));
+    result->longestAnchor = 0;
+
+    // build the trie as first child / next sibling lists
+    int capacity = 64;
+    int numberOfNodes = 1;
+    int* nodeSymbols = (int*) malloc(sizeof(int) * capacity);
+    int* firstChildren = (int*) malloc(sizeof(int) * capacity);
+    int* nextSiblings = (int*) malloc(sizeof(int) * capacity);
+    int* outputHeads = (int*) malloc(sizeof(int) * capacity);
+    nodeSymbols[0] = -1;
+    firstChildren[0] = -1;
+    nextSiblings[0] = -1;
+    outputHeads[0] = -1;
+
+    int* outputNext = (int*) malloc(sizeof(int) * (numberOfClauses + 1));
+    int* outputClauses = (int*) malloc(sizeof(int) * (numberOfClauses + 1));
+    int numberOfOutputs = 0;
+
+    int clauseNumber = 0;
+    for (int i=0; i<numberOfRules; i++){
+        rules[i]->firstClause = clauseNumber;
+        for (int j=0; j<rules[i]->numberOfClauses; j++){
+            Matcher* matcher = rules[i]->clauses[j]->matcher;
+
+            int runStart;
+            int runLength = longestLiteralRun(matcher, &runStart);
+            result->presetMarks[clauseNumber] = (runLength == 0) ? CANDIDATE_ANCHOR : 0;
+            if (matcher->firstAny){
+                result->presetMarks[clauseNumber] |= CANDIDATE_FIRST;
+            } else {
+                for (int k=0; k<matcher->numberOfFirstTokens; k++){
+                    int symbol = matcher->firstTokens[k];
+                    if (!repeatsFirstToken(matcher, k)){
+                        result->firstClauses[firstPlacement[symbol]] = clauseNumber;
+                        firstPlacement[symbol]++;
+                    }
+                }
+            }
+            if (runLength > result->longestAnchor){
+                result->longestAnchor = runLength;
+            }
+
+            uint64_t* required = &result->requiredLiterals[clauseNumber * DISPATCH_FILTER_WORDS];
+            for (int k=0; k<matcher->numberOfTokens; k++){
+                if (isRequired(matcher, k)){
+                    DISPATCH_FILTER_ADD(required, matcher->matchingTokens[k][0]);
+                }
+            }
+
+            int node = 0;
+            for (int k=runStart; k<runStart+runLength; k++){
+                int symbol = matcher->matchingTokens[k][0];
+                int child = firstChildren[node];
+                while (child != -1 && nodeSymbols[child] != symbol){
+                    child = nextSiblings[child];
+                }
+                if (child == -1){
+                    if (numberOfNodes == capacity){
+                        capacity *= 2;
+                        nodeSymbols = realloc(nodeSymbols, sizeof(int) * capacity);
+                        firstChildren = realloc(firstChildren, sizeof(int) * capacity);
+                        nextSiblings = realloc(nextSiblings, sizeof(int) * capacity);
+                        outputHeads = realloc(outputHeads, sizeof(int) * capacity);
+                    }
+                    child = numberOfNodes;
+                    numberOfNodes++;
+                    nodeSymbols[child] = symbol;
+                    firstChildren[child] = -1;
+                    nextSiblings[child] = firstChildren[node];
+                    outputHeads[child] = -1;
+                    firstChildren[node] = child;
+                }
+                node = child;
+            }
+
+            if (runLength > 0){
+                outputClauses[numberOfOutputs] = clauseNumber;
+                outputNext[numberOfOutputs] = outputHeads[node];
+                outputHeads[node] = numberOfOutputs;
+                numberOfOutputs++;
+            }
+
+            clauseNumber++;
+        }
+    }
+
+    // flatten the children into sorted edge arrays
+    result->numberOfNodes = numberOfNodes;
+    result->edgeStart = (int*) malloc(sizeof(int) * (numberOfNodes + 1));
+    result->edgeSymbols = (int*) malloc(sizeof(int) * numberOfNodes);
+    result->edgeTargets = (int*) malloc(sizeof(int) * numberOfNodes);
+    int* edgePairs = (int*) malloc(sizeof(int) * 2 * numberOfNodes);
+    int numberOfEdges = 0;
+    for (int i=0; i<numberOfNodes; i++){
+        result->edgeStart[i] = numberOfEdges;
+        int start = numberOfEdges;
+        for (int child=firstChildren[i]; child != -1; child = nextSiblings[child]){
+            edgePairs[2*numberOfEdges] = nodeSymbols[child];
+            edgePairs[2*numberOfEdges+1] = child;
+            numberOfEdges++;
+        }
+        qsort(edgePairs + 2*start, numberOfEdges - start, sizeof(int) * 2, compareEdges);
+    }
+    result->edgeStart[numberOfNodes] = numberOfEdges;
+    for (int i=0; i<numberOfEdges; i++){
+        result->edgeSymbols[i] = edgePairs[2*i];
+        result->edgeTargets[i] = edgePairs[2*i+1];
+    }
+
+    // compute the failure links breadth first
+    result->failures = (int*) malloc(sizeof(int) * numberOfNodes);
+    result->outputLinks = (int*) malloc(sizeof(int) * numberOfNodes);
+    int* queue = (int*) malloc(sizeof(int) * numberOfNodes);
+    int queueStart = 0;
+    int queueEnd = 0;
+
+    result->failures[0] = 0;
+    result->outputLinks[0] = -1;
+    queue[queueEnd++] = 0;
+    while (queueStart < queueEnd){
+        int node = queue[queueStart++];
+        for (int i=result->edgeStart[node]; i<result->edgeStart[node+1]; i++){
+            int child = result->edgeTargets[i];
+            int symbol = result->edgeSymbols[i];
+
+            int failure = 0;
+            if (node != 0){
+                failure = result->failures[node];
+                while (failure != 0 && Dispatch_edge(result, failure, symbol) == -1){
+                    failure = result->failures[failure];
+                }
+                int target = Dispatch_edge(result, failure, symbol);
+                failure = (target == -1) ? 0 : target;
+            }
+            result->failures[child] = failure;
+            result->outputLinks[child] = (outputHeads[failure] != -1) ? failure : result->outputLinks[failure];
+
+            queue[queueEnd++] = child;
+        }
+    }
+
+    result->outputHeads = outputHeads;
+    result->numberOfOutputs = numberOfOutputs;
+    result->outputNext = outputNext;
+    result->outputClauses = outputClauses;
+
+    // memory cleanup
+    free(firstPlacement);
+    free(nodeSymbols);
+    free(firstChildren);
+    free(nextSiblings);
+    free(edgePairs);
+    free(queue);
+
+    DBG("Dispatch built: %d clauses, %d nodes, longest anchor %d\n", numberOfClauses, numberOfNodes, result->longestAnchor);
+    return result;
+}
+
+// clear the marks of every clause except the ones that do not need them (and the present filter)
+int Dispatch_reset(Dispatch* instance, char* candidates, uint64_t* present){
+    memcpy(candidates, instance->presetMarks, sizeof(char) * instance->numberOfClauses);
+    memset(present, 0, sizeof(uint64_t) * DISPATCH_FILTER_WORDS);
+    return 0;
+}
+
+// mark every clause whose literal run or first symbol occurs in tokens[start, end)
+// and add the symbols of the databases among them to the present filter
+// (tokens only the request has are in no clause, so they are left out)
+int Dispatch_scan(Dispatch* instance, Sequence* tokens, int start, int end, char* candidates, uint64_t* present){
+    int node = 0;
+    for (int i=start; i<end; i++){
+        int token = SEQUENCE_GET(tokens, i);
+        int target = Dispatch_edge(instance, node, token);
+        while (target == -1 && node != 0){
+            node = instance->failures[node];
+            target = Dispatch_edge(instance, node, token);
+        }
+        node = (target == -1) ? 0 : target;
+
+        int outputNode = (instance->outputHeads[node] != -1) ? node : instance->outputLinks[node];
+        while (outputNode != -1){
+            for (int j=instance->outputHeads[outputNode]; j != -1; j = instance->outputNext[j]){
+                candidates[instance->outputClauses[j]] |= CANDIDATE_ANCHOR;
+            }
+            outputNode = instance->outputLinks[outputNode];
+        }
+
+        if (token < instance->numberOfSymbols){
+            DISPATCH_FILTER_ADD(present, token);
+            for (int j=instance->firstStart[token]; j<instance->firstStart[token+1]; j++){
+                candidates[instance->firstClauses[j]] |= CANDIDATE_FIRST;
+            }
+        }
+    }
+    return 0;
+}
+
+// free a Dispatch
+int Dispatch_free(Dispatch* instance){
+    free(instance->presetMarks);
+    free(instance->edgeStart);
+    free(instance->edgeSymbols);
+    free(instance->edgeTargets);
+    free(instance->failures);
+    free(instance->outputHeads);
+    free(instance->outputLinks);
+    free(instance->outputNext);
+    free(instance->outputClauses);
+    free(instance->firstStart);
+    free(instance->firstClauses);
+    free(instance->requiredLiterals);
+    free(instance);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "structures.h"
+
+// marks of a clause in a candidates array
+#define CANDIDATE_ANCHOR 1
+#define CANDIDATE_FIRST 2
+#define CANDIDATE (CANDIDATE_ANCHOR | CANDIDATE_FIRST)
+
+// the bit of a symbol in a bloom filter of DISPATCH_FILTER_WORDS words (multiplicative hash to 8 bits)
+#define DISPATCH_FILTER_BIT(symbol) (((uint32_t) (symbol) * 2654435761u) >> 24)
+
+// add a symbol to a bloom filter
+#define DISPATCH_FILTER_ADD(filter, symbol) ((filter)[DISPATCH_FILTER_BIT(symbol) >> 6] |= (uint64_t) 1 << (DISPATCH_FILTER_BIT(symbol) & 63))
+
+// whether every symbol of the required filter may be in the present filter (unrolled for DISPATCH_FILTER_WORDS = 4)
+#define DISPATCH_FILTER_COVERS(present, required) \
+    ((((required)[0] & ~(present)[0]) | ((required)[1] & ~(present)[1]) | ((required)[2] & ~(present)[2]) | ((required)[3] & ~(present)[3])) == 0)
+
+// build the Dispatch for an array of compiled rules
+Dispatch* Dispatch_init(Rule** rules, int numberOfRules, int numberOfSymbols);
+
+// clear the marks of every clause except the ones that do not need them (and the present filter)
+int Dispatch_reset(Dispatch* instance, char* candidates, uint64_t* present);
+
+// mark every clause whose literal run or first symbol occurs in tokens[start, end)
+// and add the symbols of the databases among them to the present filter
+int Dispatch_scan(Dispatch* instance, Sequence* tokens, int start, int end, char* candidates, uint64_t* present);
+
+// free a Dispatch
+int Dispatch_free(Dispatch* instance);
+
+#endif
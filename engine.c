@@ -1,17 +1,68 @@
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "debug.h"
 #include "structures.h"
 
+#include "symbol.h"
 #include "clause.h"
 #include "rule.h"
+#include "dispatch.h"
+#include "sequence.h"
+#include "arena.h"
 #include "database.h"
+#include "parallel.h"
+#include "memo.h"
+#include "image.h"
+#include "stats.h"
+#include "histogram.h"
+#include "trace.h"
+#include "history.h"
+#include "profile.h"
+#include "context.h"
 #include "engine.h"
 
+#define ENGINE_ARENA_BLOCK_SIZE (256 * 1024)
+
 ///////////////////////////////////////////////////
 // Private Functions
-int Engine_compile(Engine* instance){
+
+// read one database file and find its rules
+void Engine_readDatabase(void* data, int index, int worker){
+    EngineLoad* load = (EngineLoad*) data;
+    if (load->databaseFilenames != NULL){
+        load->engine->databases[index] = Database_read(load->databaseFilenames[index]);
+    } else {
+        load->engine->databases[index] = Database_readString(load->databaseStrings[index]);
+    }
+}
+
+// parse one rule of any database
+void Engine_parseRule(void* data, int index, int worker){
+    EngineLoad* load = (EngineLoad*) data;
+    Database_parseRule(load->engine->databases[load->ruleDatabases[index]], load->ruleIndices[index]);
+}
+
+// parse the tokens of one clause into a matcher
+void Engine_parseMatcher(void* data, int index, int worker){
+    EngineLoad* load = (EngineLoad*) data;
+    Clause_parseMatcher(load->clauses[index], load->engine->workerArenas[worker]);
+}
+
+// compile the automaton of one clause
+void Engine_compileMatcher(void* data, int index, int worker){
+    EngineLoad* load = (EngineLoad*) data;
+    Clause_compileMatcher(load->clauses[index], load->engine->workerArenas[worker]);
+}
+
+// cache the best metrics of one rule
+void Engine_cacheBestMetrics(void* data, int index, int worker){
+    EngineLoad* load = (EngineLoad*) data;
+    Rule_cacheBestMetrics(load->engine->compiledRules[index]);
+}
+
+int Engine_compile(Engine* instance, int numberOfThreads){
     DBG("Performing Engine compilation...\n");
 
     // get the number of total rules
@@ -30,91 +81,452 @@ int Engine_compile(Engine* instance){
     for (int i=0; i<instance->numberOfDatabases; i++){
         for (int j=0; j<instance->databases[i]->numberOfRules; j++){
             instance->compiledRules[ruleNumber] = instance->databases[i]->rules[j];
+            instance->compiledRules[ruleNumber]->number = ruleNumber;
             ruleNumber++;
         }
     }
 
     DBG("All rules gathered.\n");
     
-    // create the Matcher for each clause of each rule
-    DBG("Creating Matchers for each clause of each rule...\n");
+    // every clause in order
+    int numberOfClauses = 0;
+    for (int i=0; i<instance->numberOfCompiledRules; i++){
+        numberOfClauses += instance->compiledRules[i]->numberOfClauses;
+    }
+    EngineLoad load;
+    load.engine = instance;
+    load.clauses = (Clause**) malloc(sizeof(Clause*) * (numberOfClauses + 1));
+    int clauseNumber = 0;
     for (int i=0; i<instance->numberOfCompiledRules; i++){
         for (int j=0; j<instance->compiledRules[i]->numberOfClauses; j++){
-            Clause_createMatcher(instance->compiledRules[i]->clauses[j]);
+            load.clauses[clauseNumber] = instance->compiledRules[i]->clauses[j];
+            clauseNumber++;
+        }
+    }
+
+    // each thread allocates its matchers from its own arena
+    instance->numberOfWorkerArenas = numberOfThreads;
+    instance->workerArenas = (Arena**) malloc(sizeof(Arena*) * numberOfThreads);
+    instance->workerArenas[0] = instance->compiledArena;
+    for (int i=1; i<numberOfThreads; i++){
+        instance->workerArenas[i] = Arena_init(ENGINE_ARENA_BLOCK_SIZE);
+    }
+
+    // create the Matcher for each clause of each rule
+    // (symbols are interned in clause order so every id is the same as on one thread)
+    DBG("Creating Matchers for each clause of each rule...\n");
+    Parallel_for(numberOfThreads, numberOfClauses, Engine_parseMatcher, &load);
+    for (int i=0; i<numberOfClauses; i++){
+        Clause_internMatcher(load.clauses[i], instance->symbols);
+    }
+    Parallel_for(numberOfThreads, numberOfClauses, Engine_compileMatcher, &load);
+    free(load.clauses);
+
+    // gather the bracket pairs of every database
+    instance->numberOfBracketPairs = 0;
+    for (int i=0; i<instance->numberOfDatabases; i++){
+        instance->numberOfBracketPairs += instance->databases[i]->numberOfBracketPairs;
+    }
+    instance->brackets = (int*) malloc(sizeof(int) * (2 * instance->numberOfBracketPairs + 1));
+    int bracketNumber = 0;
+    for (int i=0; i<instance->numberOfDatabases; i++){
+        for (int j=0; j<2*instance->databases[i]->numberOfBracketPairs; j++){
+            instance->brackets[bracketNumber] = SymbolTable_intern(instance->symbols, instance->databases[i]->brackets[j]);
+            bracketNumber++;
         }
     }
 
     // save the minimal and maximal metric for each rule
     DBG("Caching the minimal and maximal metrics for each rule...\n");
+    Parallel_for(numberOfThreads, instance->numberOfCompiledRules, Engine_cacheBestMetrics, &load);
+
+    // find the largest automaton (for the scratch space of each Context)
+    instance->largestAutomaton = 1;
+    instance->largestCaptureSize = 1;
     for (int i=0; i<instance->numberOfCompiledRules; i++){
-        Rule_cacheBestMetrics(instance->compiledRules[i]);
+        for (int j=0; j<instance->compiledRules[i]->numberOfClauses; j++){
+            Matcher* matcher = instance->compiledRules[i]->clauses[j]->matcher;
+            if (matcher->numberOfStates > instance->largestAutomaton){
+                instance->largestAutomaton = matcher->numberOfStates;
+            }
+            if (matcher->captureSize > instance->largestCaptureSize){
+                instance->largestCaptureSize = matcher->captureSize;
+            }
+        }
     }
 
+    // index the literal runs of every clause
+    DBG("Building the dispatch automaton...\n");
+    instance->dispatch = Dispatch_init(instance->compiledRules, instance->numberOfCompiledRules, instance->symbols->numberOfSymbols);
+
 
     DBG("Engine compilation finished!\n");
     return 0;
 }
 
 
-///////////////////////////////////////////////////
-// Public Functions
+// stop a rewrite whose tokens after pass lastPass repeat the state after pass repeatedState
+// the tokens become the best state seen and the rules of the cycle are counted
+int Engine_stopCycle(Engine* instance, Context* context, Sequence* tokens, int repeatedState, int lastPass){
+    History* history = context->history;
+    DBG("The tokens after pass %d repeat the tokens after pass %d\n", lastPass, repeatedState);
+    History_restoreBest(history, tokens);
 
-// initialize a new Engine
-Engine* Engine_init(int numberOfDatabaseFiles, char** databaseFilenames){
-    Engine* result = malloc(sizeof(Engine));
-
-    // initialize the database files
-    result->numberOfDatabases = numberOfDatabaseFiles;
-    result->databases = malloc(sizeof(Database*) * numberOfDatabaseFiles);
-    for (int i=0; i<numberOfDatabaseFiles; i++){
-        result->databases[i] = Database_init(databaseFilenames[i]);
+    int* rules = (int*) Arena_alloc(context->arena, sizeof(int) * instance->numberOfCompiledRules);
+    int numberOfRules = History_rules(history, rules, instance->numberOfCompiledRules);
+    COUNTER_ADD(context->numberOfCycles, 1);
+    for (int i=0; i<numberOfRules; i++){
+        COUNTER_ADD(context->ruleCycles[rules[i]], 1);
     }
 
-    // compile the all of the rules
-    Engine_compile(result);
-
-    return result;
+    if (context->tracing){
+        context->trace->cycleSegment = context->trace->segment;
+        context->trace->cycleStart = repeatedState;
+        context->trace->cycleEnd = lastPass;
+        context->trace->cycleLength = SEQUENCE_LENGTH(tokens);
+    }
+    return 0;
 }
 
+// rewrite tokens until a pass over every rule makes no substitution
+// (or the tokens after a pass repeat an earlier state, which would repeat forever)
+// a request stopped by its limits keeps the tokens reached so far (or the best state after a pass if that is better)
+int Engine_rewrite(Engine* instance, Context* context, Sequence* tokens, int metric, int direction){
+    // clauses that could match the current tokens
+    char* candidates = context->candidates;
 
-// execute an Engine on an array of tokens
-// metric = index of the metric to minimize/maximize
-// direction = positive or negative for whether to minimize or maximize
-// return an array of strings. (last element is NULL)
-char** Engine_execute(Engine* instance, char** tokens, int numberOfTokens, int metric, int direction, int* newLength){
-    DBG("---------------------------------------------------\n");
-    DBG("Executing Engine on an array of strings...\n");
-    char** result = tokens;
-
-    int initialLength = numberOfTokens;
+    // the state after every pass
+    History* history = context->history;
+    History_reset(history, tokens, direction);
 
     int substitutionsMade;
     int totalSubstitutions = 0;
     // do not stop until no substitutions were made on a pass
     int currentPass = 1;
     do {
+        if (context->passesLeft == 0){
+            context->stopped = LIMIT_PASSES;
+        }
+        if (context->stopped){
+            History_restoreBetter(history, tokens);
+            break;
+        }
         DBG("+++++++++++++++++++++++++\n");
         DBG("Current Pass: %d\n", currentPass);
         substitutionsMade = 0;
+        context->pass = currentPass;
+        if (context->tracing){
+            context->trace->pass = currentPass;
+        }
+
+        // find the candidate clauses in one sweep over the tokens
+        Dispatch_reset(instance->dispatch, candidates, context->presentTokens);
+        Dispatch_scan(instance->dispatch, tokens, 0, SEQUENCE_LENGTH(tokens), candidates, context->presentTokens);
+
         // iterate through the array of rules in order
-        for (int i=0; i<instance->numberOfCompiledRules; i++){
+        for (int i=0; i<instance->numberOfCompiledRules && !context->stopped && !CONTEXT_EXPIRED(context); i++){
             int substitutions = 0;
             DBG("Executing rule %d/%d... ##############\n", i+1, instance->numberOfCompiledRules);
-            result = Rule_execute(instance->compiledRules[i], result, numberOfTokens, metric, direction, &substitutions, &numberOfTokens, 0, 0);
+            if (context->tracing){
+                context->trace->rule = i;
+            }
+            Rule_execute(instance->compiledRules[i], tokens, metric, direction, &substitutions, 0, 0, context);
+            if (substitutions > 0){
+                History_addRule(history, i);
+            }
             substitutionsMade += substitutions;
             totalSubstitutions += substitutions;
         }
         currentPass++;
-    } while (substitutionsMade != 0);
+        if (context->passesLeft > 0){
+            context->passesLeft--;
+        }
+
+        // a pass cut short is not a state (the loop stops at its top)
+        if (substitutionsMade != 0 && !context->stopped){
+            int repeatedState = History_record(history, tokens);
+            if (repeatedState != -1){
+                Engine_stopCycle(instance, context, tokens, repeatedState, currentPass - 1);
+                break;
+            }
+        }
+    } while (substitutionsMade != 0 || context->stopped);
 
-    *newLength = numberOfTokens;
     DBG("Engine execution finished! (%d total substitutions made, %d passes)\n", totalSubstitutions, currentPass-1);
-    DBG("Number of tokens: %d -> %d\n", initialLength, numberOfTokens);
+    COUNTER_ADD(context->numberOfPasses, currentPass - 1);
+    COUNTER_ADD(context->numberOfSubstitutions, totalSubstitutions);
+    if (context->tracing){
+        context->trace->numberOfPasses += currentPass - 1;
+    }
+    return 0;
+}
+
+// bring every balanced bracket segment of tokens to its normal form, innermost first
+// a segment seen before in the same request is replaced by its memoized normal form
+int Engine_rewriteSegments(Engine* instance, Context* context, Sequence* tokens, int metric, int direction){
+    Memo* memo = context->memo;
+    Memo_reset(memo);
+
+    int depth = 0;
+    int position = 0;
+    while (position < SEQUENCE_LENGTH(tokens)){
+        int token = SEQUENCE_GET(tokens, position);
+
+        // find the bracket pair of the token
+        int pair = -1;
+        int isOpen = 0;
+        for (int i=0; i<instance->numberOfBracketPairs; i++){
+            if (instance->brackets[2*i] == token){
+                pair = i;
+                isOpen = 1;
+                break;
+            }
+            if (instance->brackets[2*i+1] == token){
+                pair = i;
+                break;
+            }
+        }
+
+        if (pair != -1 && isOpen){
+            if (depth == context->segmentCapacity){
+                context->segmentCapacity = context->segmentCapacity ? context->segmentCapacity * 2 : 16;
+                context->segmentStarts = (int*) realloc(context->segmentStarts, sizeof(int) * context->segmentCapacity);
+                context->segmentPairs = (int*) realloc(context->segmentPairs, sizeof(int) * context->segmentCapacity);
+            }
+            context->segmentStarts[depth] = position;
+            context->segmentPairs[depth] = pair;
+            depth++;
+            position++;
+            continue;
+        }
+
+        // a close bracket that does not match the innermost open bracket is an ordinary token
+        if (pair == -1 || depth == 0 || context->segmentPairs[depth-1] != pair){
+            position++;
+            continue;
+        }
+
+        depth--;
+        int start = context->segmentStarts[depth];
+        int length = position - start + 1;
+
+        uint64_t hash = Memo_hash(tokens, start, length);
+        MemoEntry* entry = Memo_find(memo, hash, tokens, start, length);
+        if (entry == NULL){
+            DBG("Rewriting segment [%d, %d)\n", start, start + length);
+            int* segmentTokens = (int*) Arena_alloc(context->arena, sizeof(int) * length);
+            for (int i=0; i<length; i++){
+                segmentTokens[i] = SEQUENCE_GET(tokens, start + i);
+            }
+            Sequence* segment = Sequence_init(segmentTokens, length);
+            if (context->tracing){
+                context->trace->segment = start;
+            }
+            Engine_rewrite(instance, context, segment, metric, direction);
+            if (context->tracing){
+                context->trace->segment = -1;
+            }
+
+            int normalLength = SEQUENCE_LENGTH(segment);
+            int* normalForm = (int*) Arena_alloc(context->arena, sizeof(int) * (normalLength + 1));
+            Sequence_copy(segment, normalForm);
+            Sequence_free(segment);
+
+            // a segment cut short by the request's limits is not a normal form (and nothing else is rewritten)
+            if (context->stopped){
+                Sequence_splice(tokens, start, length, normalForm, normalLength);
+                break;
+            }
+            entry = Memo_insert(memo, context->arena, hash, segmentTokens, length, normalForm, normalLength);
+        } else {
+            DBG("Memoized segment [%d, %d)\n", start, start + length);
+        }
+
+        // continue after the normal form (it is not searched for segments again)
+        Sequence_splice(tokens, start, length, entry->normalForm, entry->normalLength);
+        position = start + entry->normalLength;
+    }
+
+    return 0;
+}
+
+
+// the rules that made their substitutions on the earliest passes in the profile come first
+// and the rules that made none come last (ties keep the database order)
+int compareRuleOrder(const void* a, const void* b){
+    RuleProfile* first = ((RuleOrder*) a)->profile;
+    RuleProfile* second = ((RuleOrder*) b)->profile;
+    if ((first->substitutions == 0) != (second->substitutions == 0)){
+        return first->substitutions == 0 ? 1 : -1;
+    }
+    if (first->substitutions > 0){
+        double firstPass = (double) first->substitutionPasses / first->substitutions;
+        double secondPass = (double) second->substitutionPasses / second->substitutions;
+        if (firstPass != secondPass){
+            return firstPass < secondPass ? -1 : 1;
+        }
+    }
+    return ((RuleOrder*) a)->rule->number - ((RuleOrder*) b)->rule->number;
+}
+
+// initialize a new Engine from database files or strings (whichever is not NULL)
+Engine* Engine_load(int numberOfDatabaseFiles, char** databaseFilenames, char** databaseStrings, int numberOfThreads){
+    Engine* result = malloc(sizeof(Engine));
+
+    result->timeClauses = 0;
+    memset(&result->limits, 0, sizeof(Limits));
+    result->symbols = SymbolTable_init();
+    result->compiledArena = Arena_init(ENGINE_ARENA_BLOCK_SIZE);
+    result->image = NULL;
+    result->imageSize = 0;
+
+    if (numberOfThreads < 1){
+        numberOfThreads = 1;
+    }
+
+    // read the database files and split them into rules
+    result->numberOfDatabases = numberOfDatabaseFiles;
+    result->databases = malloc(sizeof(Database*) * numberOfDatabaseFiles);
+    EngineLoad load;
+    load.engine = result;
+    load.databaseFilenames = databaseFilenames;
+    load.databaseStrings = databaseStrings;
+    Parallel_for(numberOfThreads, numberOfDatabaseFiles, Engine_readDatabase, &load);
+
+    // parse the rules of every file together (each rule keeps its place in its database)
+    int numberOfRules = 0;
+    for (int i=0; i<numberOfDatabaseFiles; i++){
+        numberOfRules += result->databases[i]->numberOfRules;
+    }
+    load.ruleDatabases = (int*) malloc(sizeof(int) * (numberOfRules + 1));
+    load.ruleIndices = (int*) malloc(sizeof(int) * (numberOfRules + 1));
+    int ruleNumber = 0;
+    for (int i=0; i<numberOfDatabaseFiles; i++){
+        for (int j=0; j<result->databases[i]->numberOfRules; j++){
+            load.ruleDatabases[ruleNumber] = i;
+            load.ruleIndices[ruleNumber] = j;
+            ruleNumber++;
+        }
+    }
+    Parallel_for(numberOfThreads, numberOfRules, Engine_parseRule, &load);
+    free(load.ruleDatabases);
+    free(load.ruleIndices);
+    for (int i=0; i<numberOfDatabaseFiles; i++){
+        Database_finish(result->databases[i]);
+    }
+
+    // compile the all of the rules
+    Engine_compile(result, numberOfThreads);
+
     return result;
 }
 
 
+///////////////////////////////////////////////////
+// Public Functions
+
+// initialize a new Engine
+// the databases are read, parsed and compiled on numberOfThreads threads
+Engine* Engine_init(int numberOfDatabaseFiles, char** databaseFilenames, int numberOfThreads){
+    return Engine_load(numberOfDatabaseFiles, databaseFilenames, NULL, numberOfThreads);
+}
+
+// initialize a new Engine from the contents of database files instead of their names
+Engine* Engine_initFromStrings(int numberOfDatabases, char** databaseStrings, int numberOfThreads){
+    return Engine_load(numberOfDatabases, NULL, databaseStrings, numberOfThreads);
+}
+
+
+// execute an Engine on a Sequence of tokens (symbol ids from instance->symbols) in place
+// context = mutable state for the execution (its arena is reset first, its limits apply)
+// metric = index of the metric to minimize/maximize
+// direction = positive or negative for whether to minimize or maximize
+// returns 1 if a limit stopped the rewrite first (tokens are the best reached so far), else 0
+int Engine_execute(Engine* instance, Context* context, Sequence* tokens, int metric, int direction){
+    DBG("---------------------------------------------------\n");
+    DBG("Executing Engine on an array of tokens...\n");
+    int initialLength = SEQUENCE_LENGTH(tokens);
+    long start = Stats_now();
+    long passesBefore = context->numberOfPasses;
+    long substitutionsBefore = context->numberOfSubstitutions;
 
+    // nothing from the previous request is needed anymore
+    Arena_reset(context->arena);
+    if (context->tracing){
+        Trace_clear(context->trace);
+    }
+    COUNTER_ADD(context->numberOfExecutions, 1);
+    Context_startLimits(context);
 
+    // bring every bracket segment to its normal form first
+    if (instance->numberOfBracketPairs > 0){
+        Engine_rewriteSegments(instance, context, tokens, metric, direction);
+    }
 
+    if (!context->stopped){
+        Engine_rewrite(instance, context, tokens, metric, direction);
+    }
+    if (context->stopped){
+        DBG("Stopped by limit %d\n", context->stopped);
+        COUNTER_ADD(context->numberOfPartials, 1);
+        if (context->tracing){
+            context->trace->stopped = context->stopped;
+        }
+    }
 
+    DBG("Number of tokens: %d -> %d\n", initialLength, SEQUENCE_LENGTH(tokens));
+    RequestHistograms* histograms = context->histograms;
+    Histogram_record(&histograms->nanoseconds, Stats_now() - start);
+    Histogram_record(&histograms->passes, context->numberOfPasses - passesBefore);
+    Histogram_record(&histograms->substitutions, context->numberOfSubstitutions - substitutionsBefore);
+    Histogram_record(&histograms->inputTokens, initialLength);
+    Histogram_record(&histograms->outputTokens, SEQUENCE_LENGTH(tokens));
+    return context->stopped != 0;
+}
+
+// reorder the compiled rules by a profile of an earlier run: the rules whose substitutions came on the earliest passes
+// (by their mean pass) are tried first and the rules that made none last, ties keep the database order
+// (a rule that fires early in a pass saves passes, but the order of the rules can change the results)
+// returns 1 without reordering if the profile is of other databases or the Engine was loaded from an image
+int Engine_orderRules(Engine* instance, Profile* profile){
+    if (instance->image != NULL || !Profile_matches(profile, instance)){
+        return 1;
+    }
+
+    RuleOrder* order = (RuleOrder*) malloc(sizeof(RuleOrder) * (instance->numberOfCompiledRules + 1));
+    for (int i=0; i<instance->numberOfCompiledRules; i++){
+        order[i].rule = instance->compiledRules[i];
+        order[i].profile = &profile->rules[instance->compiledRules[i]->number];
+    }
+    qsort(order, instance->numberOfCompiledRules, sizeof(RuleOrder), compareRuleOrder);
+    for (int i=0; i<instance->numberOfCompiledRules; i++){
+        instance->compiledRules[i] = order[i].rule;
+    }
+    free(order);
+
+    // the clauses are numbered in the new order
+    Dispatch_free(instance->dispatch);
+    instance->dispatch = Dispatch_init(instance->compiledRules, instance->numberOfCompiledRules, instance->symbols->numberOfSymbols);
+    return 0;
+}
+
+// free an Engine and everything it compiled
+int Engine_free(Engine* instance){
+    if (instance->image != NULL){
+        return Image_free(instance);
+    }
+    for (int i=0; i<instance->numberOfDatabases; i++){
+        Database_free(instance->databases[i]);
+    }
+    free(instance->databases);
+    free(instance->compiledRules);
+    free(instance->brackets);
+    Dispatch_free(instance->dispatch);
+    SymbolTable_free(instance->symbols);
+    for (int i=0; i<instance->numberOfWorkerArenas; i++){
+        Arena_free(instance->workerArenas[i]);
+    }
+    free(instance->workerArenas);
+    free(instance);
+    return 0;
+}
@@ -6,9 +6,22 @@
 #include "database.h"
 
 // initialize a new Engine
-Engine* Engine_init(int numberOfDatabaseFiles, char** databaseFilenames);
+// the databases are read, parsed and compiled on numberOfThreads threads
+Engine* Engine_init(int numberOfDatabaseFiles, char** databaseFilenames, int numberOfThreads);
 
-// execute the engine on an array of strings
-char** Engine_execute(Engine* instance, char** tokens, int numberOfTokens, int metric, int direction, int* newLength);
+// initialize a new Engine from the contents of database files instead of their names
+Engine* Engine_initFromStrings(int numberOfDatabases, char** databaseStrings, int numberOfThreads);
+
+// execute the engine on a Sequence of symbol ids in place
+// returns 1 if the Context's limits stopped it before a fixpoint (the result is partial), else 0
+int Engine_execute(Engine* instance, Context* context, Sequence* tokens, int metric, int direction);
+
+// reorder the compiled rules by a profile of an earlier run (earliest mean substitution pass first,
+// rules without substitutions last, ties in database order)
+// returns 1 without reordering if the profile is of other databases or the Engine was loaded from an image
+int Engine_orderRules(Engine* instance, Profile* profile);
+
+// free an Engine and everything it compiled
+int Engine_free(Engine* instance);
 
 #endif
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "sequence.h"
+#include "context.h"
+#include "engine.h"
+#include "cache.h"
+#include "batch.h"
+#include "frame.h"
+
+///////////////////////////////////////////
+// Private Functions
+
+uint32_t Frame_readUint32(char* bytes){
+    unsigned char* b = (unsigned char*) bytes;
+    return (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+int Frame_appendUint32(OutputBuffer* output, uint32_t value){
+    char bytes[4] = {(char) (value & 0xff), (char) ((value >> 8) & 0xff), (char) ((value >> 16) & 0xff), (char) ((value >> 24) & 0xff)};
+    return OutputBuffer_append(output, bytes, 4);
+}
+
+int Frame_writeUint32(OutputBuffer* output, size_t offset, uint32_t value){
+    OutputBuffer placeholder = {output->bytes + offset, 0, 4};
+    return Frame_appendUint32(&placeholder, value);
+}
+
+// append a response with one error message token
+int Frame_appendError(OutputBuffer* output, char* message){
+    Frame_appendUint32(output, FRAME_STATUS_ERROR);
+    Frame_appendUint32(output, 1);
+    Frame_appendUint32(output, strlen(message));
+    OutputBuffer_append(output, message, strlen(message));
+    return 0;
+}
+
+// find the end of the request at the start of bytes (-1 = it runs past the end of the frame)
+long Frame_requestSize(char* bytes, size_t length){
+    if (length < 12){
+        return -1;
+    }
+    uint32_t numberOfTokens = Frame_readUint32(bytes + 8);
+    size_t position = 12;
+    for (uint32_t i=0; i<numberOfTokens; i++){
+        if (length - position < 4){
+            return -1;
+        }
+        uint32_t tokenLength = Frame_readUint32(bytes + position);
+        position += 4;
+        if (length - position < tokenLength){
+            return -1;
+        }
+        position += tokenLength;
+    }
+    return position;
+}
+
+// execute one request of a frame and append its response
+int Frame_executeRequest(Context* context, char* request, size_t requestSize, OutputBuffer* output){
+    int metric = (int32_t) Frame_readUint32(request);
+    int direction = (int32_t) Frame_readUint32(request + 4);
+    int numberOfTokens = Frame_readUint32(request + 8);
+
+    if (metric < 0){
+        return Frame_appendError(output, "the metric must be a non-negative integer");
+    }
+    if (direction != -1 && direction != 1){
+        return Frame_appendError(output, "the direction must be either -1 or 1");
+    }
+
+    // the same request may have been answered before
+    size_t outputStart = output->length;
+    if (context->cache != NULL && Cache_lookup(context->cache, metric, direction, request, requestSize, output)){
+        return 0;
+    }
+
+    // tokens of the previous request are not needed anymore
+    Context_clearSymbols(context);
+    if (numberOfTokens > context->inputCapacity){
+        context->inputCapacity = numberOfTokens * 2;
+        context->inputTokens = (int*) realloc(context->inputTokens, sizeof(int) * context->inputCapacity);
+    }
+
+    // tokens are interned straight from the frame
+    size_t position = 12;
+    for (int i=0; i<numberOfTokens; i++){
+        uint32_t tokenLength = Frame_readUint32(request + position);
+        position += 4;
+        context->inputTokens[i] = Context_intern(context, request + position, tokenLength);
+        position += tokenLength;
+    }
+
+    Sequence* sequence = Sequence_init(context->inputTokens, numberOfTokens);
+    int partial = Engine_execute(context->engine, context, sequence, metric, direction);
+
+    Frame_appendUint32(output, partial ? FRAME_STATUS_PARTIAL : FRAME_STATUS_OK);
+    Frame_appendUint32(output, SEQUENCE_LENGTH(sequence));
+    for (int i=0; i<SEQUENCE_LENGTH(sequence); i++){
+        char* token = Context_lookup(context, SEQUENCE_GET(sequence, i));
+        size_t tokenLength = Context_lookupLength(context, SEQUENCE_GET(sequence, i));
+        Frame_appendUint32(output, tokenLength);
+        OutputBuffer_append(output, token, tokenLength);
+    }
+    Sequence_free(sequence);
+
+    if (context->cache != NULL && !partial){
+        Cache_insert(context->cache, metric, direction, request, requestSize, output->bytes + outputStart, output->length - outputStart);
+    }
+    return 0;
+}
+
+
+///////////////////////////////////////////
+// Public Functions
+
+// get the size of the frame at the start of bytes (0 = not complete yet, -1 = too long)
+long Frame_size(char* bytes, size_t length){
+    if (length < 4){
+        return 0;
+    }
+    uint32_t frameLength = Frame_readUint32(bytes);
+    if (frameLength > FRAME_MAX_LENGTH){
+        return -1;
+    }
+    if (length - 4 < frameLength){
+        return 0;
+    }
+    return 4 + (long) frameLength;
+}
+
+// execute every request of a frame and append the response frame to output
+// (a request that runs past the end of the frame gets the last response, an error, and returns 1)
+int Frame_execute(Context* context, char* frame, size_t frameSize, OutputBuffer* output){
+    // the frame length is filled in once the responses are appended
+    size_t frameStart = output->length;
+    Frame_appendUint32(output, 0);
+
+    if (frameSize < 8){
+        Frame_appendUint32(output, 1);
+        Frame_appendError(output, "the frame is too short");
+        Frame_writeUint32(output, frameStart, output->length - frameStart - 4);
+        return 1;
+    }
+    // the peer sets the count, so it cannot be more requests than the frame has room for
+    uint32_t numberOfRequests = Frame_readUint32(frame + 4);
+    if (numberOfRequests > (frameSize - 8) / FRAME_MIN_REQUEST_SIZE){
+        Frame_appendUint32(output, 1);
+        Frame_appendError(output, "the request runs past the end of the frame");
+        Frame_writeUint32(output, frameStart, output->length - frameStart - 4);
+        return 1;
+    }
+    // the number of responses is filled in once they are appended
+    Frame_appendUint32(output, 0);
+
+    size_t position = 8;
+    uint32_t numberOfResponses = 0;
+    for (uint32_t i=0; i<numberOfRequests; i++){
+        long requestSize = Frame_requestSize(frame + position, frameSize - position);
+        numberOfResponses++;
+        if (requestSize == -1){
+            // the rest of the frame cannot be read
+            Frame_appendError(output, "the request runs past the end of the frame");
+            break;
+        }
+        Frame_executeRequest(context, frame + position, requestSize, output);
+        position += requestSize;
+    }
+
+    Frame_writeUint32(output, frameStart + 4, numberOfResponses);
+    Frame_writeUint32(output, frameStart, output->length - frameStart - 4);
+    return numberOfResponses < numberOfRequests;
+}
+
+// execute frames from input until EOF, writing each response frame to output with one write
+int Frame_run(Context* context, FILE* input, FILE* output){
+    OutputBuffer frame = {NULL, 0, 0};
+    OutputBuffer response = {NULL, 0, 0};
+    char header[4];
+
+    while (fread(header, 1, 4, input) == 4){
+        long frameSize = Frame_size(header, 4 + FRAME_MAX_LENGTH);
+        if (frameSize == -1){
+            PANIC("Frame is too long\n");
+        }
+
+        frame.length = 0;
+        OutputBuffer_append(&frame, header, 4);
+        if (frame.capacity < (size_t) frameSize){
+            frame.capacity = frameSize;
+            frame.bytes = (char*) realloc(frame.bytes, frame.capacity);
+        }
+        if (fread(frame.bytes + 4, 1, frameSize - 4, input) != (size_t) (frameSize - 4)){
+            PANIC("Frame is cut short\n");
+        }
+
+        response.length = 0;
+        Frame_execute(context, frame.bytes, frameSize, &response);
+        fwrite(response.bytes, 1, response.length, output);
+        fflush(output);
+    }
+
+    free(frame.bytes);
+    free(response.bytes);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdio.h>
+
+#include "structures.h"
+
+// Binary framing (every integer is 4 bytes little endian):
+// request frame = <frame length> <number of requests> then each request:
+//     <metric> <direction> <number of tokens> then each token: <length> <bytes>
+// response frame = <frame length> <number of responses> then each response:
+//     <status> <number of tokens> then each token: <length> <bytes>
+// the frame length counts the bytes after it
+// status 0 = the rewritten tokens, status 1 = one token with an error message,
+// status 2 = the tokens reached before a limit stopped the rewrite
+
+#define FRAME_STATUS_OK 0
+#define FRAME_STATUS_ERROR 1
+#define FRAME_STATUS_PARTIAL 2
+
+// the smallest request (a metric, a direction and no tokens)
+#define FRAME_MIN_REQUEST_SIZE 12
+
+// frames longer than this are rejected
+#define FRAME_MAX_LENGTH (1 << 30)
+
+// get the size of the frame at the start of bytes (0 = not complete yet, -1 = too long)
+long Frame_size(char* bytes, size_t length);
+
+// execute every request of a frame and append the response frame to output
+// (a request that runs past the end of the frame gets the last response, an error, and returns 1)
+int Frame_execute(Context* context, char* frame, size_t frameSize, OutputBuffer* output);
+
+// execute frames from input until EOF, writing each response frame to output with one write
+int Frame_run(Context* context, FILE* input, FILE* output);
+
+#endif
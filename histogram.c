@@ -0,0 +1,115 @@
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "stats.h"
+#include "histogram.h"
+
+///////////////////////////////////////////
+// Private Functions
+
+// bucket of a value: values below 16 have their own, then 8 per power of two
+int Histogram_bucket(long value){
+    if (value < 16){
+        return value < 0 ? 0 : (int) value;
+    }
+    int exponent = 63 - __builtin_clzl((unsigned long) value);
+    int subBucket = (int) ((value >> (exponent - 3)) & 7);
+    return 16 + (exponent - 4) * 8 + subBucket;
+}
+
+// lowest value counted in a bucket
+long Histogram_bucketStart(int bucket){
+    if (bucket < 16){
+        return bucket;
+    }
+    int exponent = (bucket - 16) / 8 + 4;
+    long subBucket = (bucket - 16) % 8;
+    return (8 + subBucket) << (exponent - 3);
+}
+
+// highest value counted in a bucket
+long Histogram_bucketEnd(int bucket){
+    if (bucket + 1 >= HISTOGRAM_BUCKETS){
+        return __LONG_MAX__;
+    }
+    return Histogram_bucketStart(bucket + 1) - 1;
+}
+
+
+///////////////////////////////////////////
+// Public Functions
+
+// count a non-negative value (only from the thread that owns the Histogram)
+int Histogram_record(Histogram* instance, long value){
+    COUNTER_ADD(instance->buckets[Histogram_bucket(value)], 1);
+    COUNTER_ADD(instance->count, 1);
+    COUNTER_ADD(instance->sum, value);
+    if (value > instance->maximum){
+        __atomic_store_n(&instance->maximum, value, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+// add the counts of a Histogram another thread may still be recording into
+int Histogram_merge(Histogram* instance, Histogram* other){
+    // the count is the sum of the buckets so a snapshot taken mid record stays consistent
+    for (int i=0; i<HISTOGRAM_BUCKETS; i++){
+        long bucketCount = COUNTER_GET(other->buckets[i]);
+        instance->buckets[i] += bucketCount;
+        instance->count += bucketCount;
+    }
+    instance->sum += COUNTER_GET(other->sum);
+    long maximum = COUNTER_GET(other->maximum);
+    if (maximum > instance->maximum){
+        instance->maximum = maximum;
+    }
+    return 0;
+}
+
+// the smallest value at least fraction of the recorded values are at or below (up to the bucket's precision)
+long Histogram_percentile(Histogram* instance, double fraction){
+    if (instance->count == 0){
+        return 0;
+    }
+    long rank = (long) (fraction * instance->count + 0.5);
+    if (rank < 1){
+        rank = 1;
+    }
+    long seen = 0;
+    for (int i=0; i<HISTOGRAM_BUCKETS; i++){
+        seen += instance->buckets[i];
+        if (seen >= rank){
+            // the bucket's highest value, but never past the largest value recorded
+            long end = Histogram_bucketEnd(i);
+            return end < instance->maximum ? end : instance->maximum;
+        }
+    }
+    return instance->maximum;
+}
+
+// print "<name>: count, mean, p50, p90, p99, p99.9, max" on one line
+int Histogram_print(Histogram* instance, char* name, FILE* fp){
+    double mean = instance->count ? (double) instance->sum / instance->count : 0.0;
+    fprintf(fp, "%s: %ld requests, mean %.1f, p50 %ld, p90 %ld, p99 %ld, p99.9 %ld, max %ld\n", name, instance->count, mean,
+        Histogram_percentile(instance, 0.5), Histogram_percentile(instance, 0.9), Histogram_percentile(instance, 0.99),
+        Histogram_percentile(instance, 0.999), instance->maximum);
+    return 0;
+}
+
+// write a Histogram as a JSON object (the percentiles and the non-empty buckets as [lowest value, count])
+int Histogram_writeJson(Histogram* instance, FILE* fp){
+    fprintf(fp, "{\"count\": %ld, \"sum\": %ld, \"max\": %ld, \"p50\": %ld, \"p90\": %ld, \"p99\": %ld, \"p999\": %ld, \"buckets\": [",
+        instance->count, instance->sum, instance->maximum, Histogram_percentile(instance, 0.5), Histogram_percentile(instance, 0.9),
+        Histogram_percentile(instance, 0.99), Histogram_percentile(instance, 0.999));
+    int first = 1;
+    for (int i=0; i<HISTOGRAM_BUCKETS; i++){
+        if (instance->buckets[i] > 0){
+            fprintf(fp, first ? "[%ld, %ld]" : ", [%ld, %ld]", Histogram_bucketStart(i), instance->buckets[i]);
+            first = 0;
+        }
+    }
+    fprintf(fp, "]}");
+    return 0;
+}
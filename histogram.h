@@ -0,0 +1,23 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+
+#include "structures.h"
+
+// count a non-negative value (only from the thread that owns the Histogram)
+int Histogram_record(Histogram* instance, long value);
+
+// add the counts of a Histogram another thread may still be recording into
+int Histogram_merge(Histogram* instance, Histogram* other);
+
+// the smallest value at least fraction of the recorded values are at or below (up to the bucket's precision)
+long Histogram_percentile(Histogram* instance, double fraction);
+
+// print "<name>: count, mean, p50, p90, p99, p99.9, max" on one line
+int Histogram_print(Histogram* instance, char* name, FILE* fp);
+
+// write a Histogram as a JSON object (the percentiles and the non-empty buckets as [lowest value, count])
+int Histogram_writeJson(Histogram* instance, FILE* fp);
+
+#endif
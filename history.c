@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "sequence.h"
+#include "history.h"
+
+///////////////////////////////////////////
+// Private Functions
+
+// copy tokens into a saved state, growing it when needed
+int History_copy(Sequence* tokens, int** saved, int* capacity){
+    int length = SEQUENCE_LENGTH(tokens);
+    if (length > *capacity){
+        *capacity = length * 2;
+        *saved = (int*) realloc(*saved, sizeof(int) * (*capacity + 1));
+    }
+    Sequence_copy(tokens, *saved);
+    return length;
+}
+
+// keep a copy of tokens if they are better than the best state so far
+int History_updateBest(History* instance, Sequence* tokens, int state){
+    int length = SEQUENCE_LENGTH(tokens);
+    if (instance->bestState != -1){
+        int better = instance->direction < 0 ? length < instance->bestLength : length > instance->bestLength;
+        if (!better){
+            return 0;
+        }
+    }
+    instance->bestLength = History_copy(tokens, &instance->bestTokens, &instance->bestCapacity);
+    instance->bestState = state;
+    return 0;
+}
+
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new empty History
+History* History_init(){
+    History* result = (History*) malloc(sizeof(History));
+    result->numberOfStates = 0;
+
+    result->savedState = -1;
+    result->power = 1;
+    result->savedLength = 0;
+    result->savedCapacity = 0;
+    result->savedTokens = NULL;
+
+    result->numberOfRules = 0;
+    result->ruleCapacity = 0;
+    result->rules = NULL;
+
+    result->direction = -1;
+    result->bestState = -1;
+    result->bestLength = 0;
+    result->bestCapacity = 0;
+    result->bestTokens = NULL;
+    return result;
+}
+
+// start a new rewrite at the tokens before its first pass
+// direction = the direction of the request (decides which state is the best)
+int History_reset(History* instance, Sequence* tokens, int direction){
+    instance->numberOfStates = 1;
+    instance->numberOfRules = 0;
+    instance->direction = direction;
+    instance->bestState = -1;
+
+    instance->savedState = 0;
+    instance->power = 1;
+    instance->savedLength = History_copy(tokens, &instance->savedTokens, &instance->savedCapacity);
+    History_updateBest(instance, tokens, 0);
+    return 0;
+}
+
+// note that a rule made a substitution on the current pass
+int History_addRule(History* instance, int rule){
+    if (instance->numberOfRules == instance->ruleCapacity){
+        instance->ruleCapacity = instance->ruleCapacity ? instance->ruleCapacity * 2 : 16;
+        instance->rules = (int*) realloc(instance->rules, sizeof(int) * instance->ruleCapacity);
+    }
+    instance->rules[instance->numberOfRules] = rule;
+    instance->numberOfRules++;
+    return 0;
+}
+
+// remember the tokens after a pass
+// The tokens are compared in full with one saved state, which moves to the current pass
+// whenever the distance to it reaches a power of two (Brent's cycle detection).
+// returns the saved state they repeat (-1 = none)
+int History_record(History* instance, Sequence* tokens){
+    int state = instance->numberOfStates;
+    instance->numberOfStates++;
+    History_updateBest(instance, tokens, state);
+
+    int length = SEQUENCE_LENGTH(tokens);
+    if (length == instance->savedLength && Sequence_equals(tokens, instance->savedTokens)){
+        return instance->savedState;
+    }
+
+    if (state - instance->savedState == instance->power){
+        instance->savedState = state;
+        instance->power *= 2;
+        instance->savedLength = History_copy(tokens, &instance->savedTokens, &instance->savedCapacity);
+        // only the rules after the saved state can be part of a cycle
+        instance->numberOfRules = 0;
+    }
+    return -1;
+}
+
+// the distinct rules that made substitutions after the saved state (written to rules, returns how many)
+int History_rules(History* instance, int* rules, int numberOfCompiledRules){
+    char* seen = (char*) calloc(numberOfCompiledRules, sizeof(char));
+    int numberOfRules = 0;
+    for (int i=0; i<instance->numberOfRules; i++){
+        if (!seen[instance->rules[i]]){
+            seen[instance->rules[i]] = 1;
+            rules[numberOfRules] = instance->rules[i];
+            numberOfRules++;
+        }
+    }
+    free(seen);
+    return numberOfRules;
+}
+
+// replace tokens with the best state seen
+int History_restoreBest(History* instance, Sequence* tokens){
+    Sequence_splice(tokens, 0, SEQUENCE_LENGTH(tokens), instance->bestTokens, instance->bestLength);
+    return 0;
+}
+
+// replace tokens with the best state seen if it is better than them
+int History_restoreBetter(History* instance, Sequence* tokens){
+    int length = SEQUENCE_LENGTH(tokens);
+    int better = instance->direction < 0 ? instance->bestLength < length : instance->bestLength > length;
+    if (better){
+        History_restoreBest(instance, tokens);
+    }
+    return 0;
+}
+
+// free a History
+int History_free(History* instance){
+    free(instance->savedTokens);
+    free(instance->rules);
+    free(instance->bestTokens);
+    free(instance);
+    return 0;
+}
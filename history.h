@@ -0,0 +1,32 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "structures.h"
+
+// initialize a new empty History
+History* History_init();
+
+// start a new rewrite at the tokens before its first pass
+// direction = the direction of the request (decides which state is the best)
+int History_reset(History* instance, Sequence* tokens, int direction);
+
+// note that a rule made a substitution on the current pass
+int History_addRule(History* instance, int rule);
+
+// remember the tokens after a pass
+// returns the earlier state they repeat (-1 = none), found within about two lengths of the cycle after it starts
+int History_record(History* instance, Sequence* tokens);
+
+// the distinct rules that made substitutions after the repeated state (written to rules, returns how many)
+int History_rules(History* instance, int* rules, int numberOfCompiledRules);
+
+// replace tokens with the best state seen
+int History_restoreBest(History* instance, Sequence* tokens);
+
+// replace tokens with the best state seen if it is better than them
+int History_restoreBetter(History* instance, Sequence* tokens);
+
+// free a History
+int History_free(History* instance);
+
+#endif
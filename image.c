@@ -0,0 +1,354 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "arena.h"
+#include "image.h"
+
+#define IMAGE_ARENA_BLOCK_SIZE (64 * 1024)
+
+// pointer to an array stored at an offset of an image
+#define IMAGE_ARRAY(type, image, offset) ((type*) ((char*) (image) + (offset)))
+
+///////////////////////////////////////////
+// Private Functions
+
+// append an array to an image (8 byte aligned) and return its offset
+int64_t Image_put(FILE* fp, void* data, size_t size){
+    static const char zeros[8] = {0};
+    long position = ftell(fp);
+    int padding = (8 - position % 8) % 8;
+    fwrite(zeros, 1, padding, fp);
+    if (size > 0){
+        fwrite(data, 1, size, fp);
+    }
+    return position + padding;
+}
+
+// append an array of ints to an image
+int64_t Image_putInts(FILE* fp, int* data, int count){
+    return Image_put(fp, data, sizeof(int) * count);
+}
+
+// append the clauses and matchers of every rule and fill in their records
+int Image_putClauses(FILE* fp, Engine* engine, ImageClause* clauses){
+    int clauseNumber = 0;
+    for (int i=0; i<engine->numberOfCompiledRules; i++){
+        Rule* rule = engine->compiledRules[i];
+        for (int j=0; j<rule->numberOfClauses; j++){
+            Clause* clause = rule->clauses[j];
+            Matcher* matcher = clause->matcher;
+            ImageClause* record = &clauses[clauseNumber];
+            int n = clause->numberOfTokens;
+
+            memset(record, 0, sizeof(ImageClause));
+            record->numberOfTokens = n;
+            record->numberOfMetrics = clause->numberOfMetrics;
+            record->tokens = Image_putInts(fp, clause->tokens, n);
+            record->metrics = Image_put(fp, clause->metrics, sizeof(float) * clause->numberOfMetrics);
+
+            record->minRepetitions = Image_putInts(fp, matcher->minRepetitions, n);
+            record->maxRepetitions = Image_putInts(fp, matcher->maxRepetitions, n);
+            record->variableAccesses = Image_putInts(fp, matcher->variableAccesses, n);
+            record->internalVariables = Image_putInts(fp, matcher->internalVariables, n);
+            record->numberOfMatchingTokens = Image_putInts(fp, matcher->numberOfMatchingTokens, n);
+            record->matchingTokens = Image_put(fp, NULL, 0);
+            for (int k=0; k<n; k++){
+                fwrite(matcher->matchingTokens[k], sizeof(int), matcher->numberOfMatchingTokens[k], fp);
+            }
+
+            record->numberOfStates = matcher->numberOfStates;
+            record->numberOfVariables = matcher->numberOfVariables;
+            record->captureSize = matcher->captureSize;
+            record->firstAny = matcher->firstAny;
+            record->numberOfFirstTokens = matcher->numberOfFirstTokens;
+            record->stateBase = Image_putInts(fp, matcher->stateBase, n + 1);
+            record->stateTokens = Image_putInts(fp, matcher->stateTokens, matcher->numberOfStates);
+            record->stateRepetitions = Image_putInts(fp, matcher->stateRepetitions, matcher->numberOfStates);
+            record->firstTokens = Image_putInts(fp, matcher->firstTokens, matcher->numberOfFirstTokens);
+
+            clauseNumber++;
+        }
+    }
+    return 0;
+}
+
+// build a Clause and its Matcher that point into a mapped image
+Clause* Image_loadClause(void* image, ImageClause* record, Arena* arena){
+    Clause* result = (Clause*) Arena_alloc(arena, sizeof(Clause));
+    Matcher* matcher = (Matcher*) Arena_alloc(arena, sizeof(Matcher));
+    int n = record->numberOfTokens;
+
+    result->numberOfTokens = n;
+    result->tokenStrings = NULL;
+    result->numberOfSymbolStrings = 0;
+    result->symbolStrings = NULL;
+    result->tokens = IMAGE_ARRAY(int, image, record->tokens);
+    result->numberOfMetrics = record->numberOfMetrics;
+    result->metrics = IMAGE_ARRAY(float, image, record->metrics);
+    result->matcher = matcher;
+
+    matcher->minRepetitions = IMAGE_ARRAY(int, image, record->minRepetitions);
+    matcher->maxRepetitions = IMAGE_ARRAY(int, image, record->maxRepetitions);
+    matcher->variableAccesses = IMAGE_ARRAY(int, image, record->variableAccesses);
+    matcher->internalVariables = IMAGE_ARRAY(int, image, record->internalVariables);
+    matcher->numberOfMatchingTokens = IMAGE_ARRAY(int, image, record->numberOfMatchingTokens);
+
+    // the alternatives of each token follow the previous token's (NULL = Any)
+    matcher->matchingTokens = (int**) Arena_alloc(arena, sizeof(int*) * n);
+    int* matchingTokens = IMAGE_ARRAY(int, image, record->matchingTokens);
+    for (int i=0; i<n; i++){
+        matcher->matchingTokens[i] = NULL;
+        if (matcher->numberOfMatchingTokens[i] > 0){
+            matcher->matchingTokens[i] = matchingTokens;
+            matchingTokens += matcher->numberOfMatchingTokens[i];
+        }
+    }
+
+    matcher->numberOfTokens = n;
+    matcher->numberOfStates = record->numberOfStates;
+    matcher->stateBase = IMAGE_ARRAY(int, image, record->stateBase);
+    matcher->stateTokens = IMAGE_ARRAY(int, image, record->stateTokens);
+    matcher->stateRepetitions = IMAGE_ARRAY(int, image, record->stateRepetitions);
+    matcher->numberOfVariables = record->numberOfVariables;
+    matcher->captureSize = record->captureSize;
+    matcher->firstAny = record->firstAny;
+    matcher->numberOfFirstTokens = record->numberOfFirstTokens;
+    matcher->firstTokens = IMAGE_ARRAY(int, image, record->firstTokens);
+
+    return result;
+}
+
+
+///////////////////////////////////////////
+// Public Functions
+
+// write a compiled Engine to a file as an image
+int Image_write(Engine* engine, char* filename){
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL){
+        PANIC("Could not open %s for writing\n", filename);
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(ImageHeader));
+    memcpy(header.magic, IMAGE_MAGIC, 4);
+    header.version = IMAGE_VERSION;
+    header.byteOrder = IMAGE_BYTE_ORDER;
+    header.headerSize = sizeof(ImageHeader);
+
+    // the header is written again once every offset is known
+    Image_put(fp, &header, sizeof(ImageHeader));
+
+    // symbols
+    SymbolTable* symbols = engine->symbols;
+    int64_t* symbolOffsets = (int64_t*) malloc(sizeof(int64_t) * (symbols->numberOfSymbols + 1));
+    for (int i=0; i<symbols->numberOfSymbols; i++){
+        symbolOffsets[i] = ftell(fp);
+        fwrite(symbols->symbols[i], 1, strlen(symbols->symbols[i]) + 1, fp);
+    }
+    header.numberOfSymbols = symbols->numberOfSymbols;
+    header.numberOfBuckets = symbols->numberOfBuckets;
+    header.symbolOffsets = Image_put(fp, symbolOffsets, sizeof(int64_t) * symbols->numberOfSymbols);
+    header.buckets = Image_putInts(fp, symbols->buckets, symbols->numberOfBuckets);
+    free(symbolOffsets);
+
+    // rules and clauses
+    Dispatch* dispatch = engine->dispatch;
+    header.numberOfRules = engine->numberOfCompiledRules;
+    header.numberOfClauses = dispatch->numberOfClauses;
+
+    ImageClause* clauses = (ImageClause*) malloc(sizeof(ImageClause) * (dispatch->numberOfClauses + 1));
+    Image_putClauses(fp, engine, clauses);
+    header.clauses = Image_put(fp, clauses, sizeof(ImageClause) * dispatch->numberOfClauses);
+    free(clauses);
+
+    ImageRule* rules = (ImageRule*) malloc(sizeof(ImageRule) * (engine->numberOfCompiledRules + 1));
+    for (int i=0; i<engine->numberOfCompiledRules; i++){
+        Rule* rule = engine->compiledRules[i];
+        memset(&rules[i], 0, sizeof(ImageRule));
+        rules[i].numberOfClauses = rule->numberOfClauses;
+        rules[i].firstClause = rule->firstClause;
+        rules[i].numberOfMetrics = rule->numberOfMetrics;
+        rules[i].number = rule->number;
+        rules[i].minimalMetric = Image_putInts(fp, rule->minimalMetric, rule->numberOfMetrics);
+        rules[i].maximalMetric = Image_putInts(fp, rule->maximalMetric, rule->numberOfMetrics);
+    }
+    header.rules = Image_put(fp, rules, sizeof(ImageRule) * engine->numberOfCompiledRules);
+    free(rules);
+
+    header.numberOfBracketPairs = engine->numberOfBracketPairs;
+    header.brackets = Image_putInts(fp, engine->brackets, 2 * engine->numberOfBracketPairs);
+
+    header.largestAutomaton = engine->largestAutomaton;
+    header.largestCaptureSize = engine->largestCaptureSize;
+
+    // dispatch
+    int numberOfEdges = dispatch->edgeStart[dispatch->numberOfNodes];
+    header.longestAnchor = dispatch->longestAnchor;
+    header.numberOfNodes = dispatch->numberOfNodes;
+    header.numberOfOutputs = dispatch->numberOfOutputs;
+    header.numberOfDispatchSymbols = dispatch->numberOfSymbols;
+    header.presetMarks = Image_put(fp, dispatch->presetMarks, sizeof(char) * dispatch->numberOfClauses);
+    header.edgeStart = Image_putInts(fp, dispatch->edgeStart, dispatch->numberOfNodes + 1);
+    header.edgeSymbols = Image_putInts(fp, dispatch->edgeSymbols, numberOfEdges);
+    header.edgeTargets = Image_putInts(fp, dispatch->edgeTargets, numberOfEdges);
+    header.failures = Image_putInts(fp, dispatch->failures, dispatch->numberOfNodes);
+    header.outputHeads = Image_putInts(fp, dispatch->outputHeads, dispatch->numberOfNodes);
+    header.outputLinks = Image_putInts(fp, dispatch->outputLinks, dispatch->numberOfNodes);
+    header.outputNext = Image_putInts(fp, dispatch->outputNext, dispatch->numberOfOutputs);
+    header.outputClauses = Image_putInts(fp, dispatch->outputClauses, dispatch->numberOfOutputs);
+    header.firstStart = Image_putInts(fp, dispatch->firstStart, dispatch->numberOfSymbols + 1);
+    header.firstClauses = Image_putInts(fp, dispatch->firstClauses, dispatch->firstStart[dispatch->numberOfSymbols]);
+    header.requiredLiterals = Image_put(fp, dispatch->requiredLiterals, sizeof(uint64_t) * DISPATCH_FILTER_WORDS * dispatch->numberOfClauses);
+
+    header.imageSize = Image_put(fp, NULL, 0);
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(ImageHeader), 1, fp);
+    if (fclose(fp)){
+        PANIC("Could not write %s\n", filename);
+    }
+
+    DBG("Wrote image %s (%ld bytes)\n", filename, (long) header.imageSize);
+    return 0;
+}
+
+// check whether a file is a compiled image
+int Image_isImage(char* filename){
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL){
+        return 0;
+    }
+    char magic[4];
+    int result = fread(magic, 1, 4, fp) == 4 && !memcmp(magic, IMAGE_MAGIC, 4);
+    fclose(fp);
+    return result;
+}
+
+// unmap the image of an Engine and free the Engine
+int Image_free(Engine* engine){
+    free(engine->compiledRules);
+    free(engine->symbols->symbols);
+    free(engine->symbols->lengths);
+    free(engine->symbols);
+    free(engine->dispatch);
+    Arena_free(engine->compiledArena);
+    munmap(engine->image, engine->imageSize);
+    free(engine);
+    return 0;
+}
+
+// map an image read only and build an Engine that executes straight from it
+// only the structs that hold pointers are allocated; every array stays in the shared mapping
+Engine* Image_load(char* filename){
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1){
+        PANIC("Could not open %s\n", filename);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) || fileStat.st_size < (off_t) sizeof(ImageHeader)){
+        PANIC("%s is not a compiled image\n", filename);
+    }
+    void* image = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED){
+        PANIC("Could not map %s\n", filename);
+    }
+
+    ImageHeader* header = (ImageHeader*) image;
+    if (memcmp(header->magic, IMAGE_MAGIC, 4)){
+        PANIC("%s is not a compiled image\n", filename);
+    }
+    if (header->version != IMAGE_VERSION || header->headerSize != sizeof(ImageHeader)){
+        PANIC("%s was compiled by another version of rbe (image version %d, expected %d). Compile it again.\n", filename, header->version, IMAGE_VERSION);
+    }
+    if (header->byteOrder != IMAGE_BYTE_ORDER){
+        PANIC("%s was compiled on a machine with another byte order. Compile it again.\n", filename);
+    }
+    if (header->imageSize != fileStat.st_size){
+        PANIC("%s is truncated\n", filename);
+    }
+
+    Engine* result = (Engine*) malloc(sizeof(Engine));
+    result->timeClauses = 0;
+    memset(&result->limits, 0, sizeof(Limits));
+    result->compiledArena = Arena_init(IMAGE_ARENA_BLOCK_SIZE);
+    result->numberOfBracketPairs = header->numberOfBracketPairs;
+    result->brackets = IMAGE_ARRAY(int, image, header->brackets);
+    result->numberOfWorkerArenas = 1;
+    result->workerArenas = &result->compiledArena;
+    result->numberOfDatabases = 0;
+    result->databases = NULL;
+    result->image = image;
+    result->imageSize = fileStat.st_size;
+
+    // the buckets are mapped read only, so nothing may be interned into these symbols
+    SymbolTable* symbols = (SymbolTable*) malloc(sizeof(SymbolTable));
+    symbols->numberOfSymbols = header->numberOfSymbols;
+    symbols->capacity = header->numberOfSymbols;
+    symbols->strings = NULL;
+    symbols->symbols = (char**) malloc(sizeof(char*) * (header->numberOfSymbols + 1));
+    symbols->lengths = (size_t*) malloc(sizeof(size_t) * (header->numberOfSymbols + 1));
+    int64_t* symbolOffsets = IMAGE_ARRAY(int64_t, image, header->symbolOffsets);
+    for (int i=0; i<header->numberOfSymbols; i++){
+        symbols->symbols[i] = IMAGE_ARRAY(char, image, symbolOffsets[i]);
+        symbols->lengths[i] = strlen(symbols->symbols[i]);
+    }
+    symbols->numberOfBuckets = header->numberOfBuckets;
+    symbols->buckets = IMAGE_ARRAY(int, image, header->buckets);
+    result->symbols = symbols;
+
+    // rules and clauses
+    ImageRule* rules = IMAGE_ARRAY(ImageRule, image, header->rules);
+    ImageClause* clauses = IMAGE_ARRAY(ImageClause, image, header->clauses);
+    result->numberOfCompiledRules = header->numberOfRules;
+    result->compiledRules = (Rule**) malloc(sizeof(Rule*) * (header->numberOfRules + 1));
+    for (int i=0; i<header->numberOfRules; i++){
+        Rule* rule = (Rule*) Arena_alloc(result->compiledArena, sizeof(Rule));
+        rule->numberOfClauses = rules[i].numberOfClauses;
+        rule->firstClause = rules[i].firstClause;
+        rule->numberOfMetrics = rules[i].numberOfMetrics;
+        rule->number = rules[i].number;
+        rule->minimalMetric = IMAGE_ARRAY(int, image, rules[i].minimalMetric);
+        rule->maximalMetric = IMAGE_ARRAY(int, image, rules[i].maximalMetric);
+        rule->clauses = (Clause**) Arena_alloc(result->compiledArena, sizeof(Clause*) * rule->numberOfClauses);
+        for (int j=0; j<rule->numberOfClauses; j++){
+            rule->clauses[j] = Image_loadClause(image, &clauses[rule->firstClause + j], result->compiledArena);
+        }
+        result->compiledRules[i] = rule;
+    }
+
+    result->largestAutomaton = header->largestAutomaton;
+    result->largestCaptureSize = header->largestCaptureSize;
+
+    // dispatch
+    Dispatch* dispatch = (Dispatch*) malloc(sizeof(Dispatch));
+    dispatch->numberOfClauses = header->numberOfClauses;
+    dispatch->presetMarks = IMAGE_ARRAY(char, image, header->presetMarks);
+    dispatch->longestAnchor = header->longestAnchor;
+    dispatch->numberOfNodes = header->numberOfNodes;
+    dispatch->edgeStart = IMAGE_ARRAY(int, image, header->edgeStart);
+    dispatch->edgeSymbols = IMAGE_ARRAY(int, image, header->edgeSymbols);
+    dispatch->edgeTargets = IMAGE_ARRAY(int, image, header->edgeTargets);
+    dispatch->failures = IMAGE_ARRAY(int, image, header->failures);
+    dispatch->outputHeads = IMAGE_ARRAY(int, image, header->outputHeads);
+    dispatch->outputLinks = IMAGE_ARRAY(int, image, header->outputLinks);
+    dispatch->numberOfOutputs = header->numberOfOutputs;
+    dispatch->outputNext = IMAGE_ARRAY(int, image, header->outputNext);
+    dispatch->outputClauses = IMAGE_ARRAY(int, image, header->outputClauses);
+    dispatch->numberOfSymbols = header->numberOfDispatchSymbols;
+    dispatch->firstStart = IMAGE_ARRAY(int, image, header->firstStart);
+    dispatch->firstClauses = IMAGE_ARRAY(int, image, header->firstClauses);
+    dispatch->requiredLiterals = IMAGE_ARRAY(uint64_t, image, header->requiredLiterals);
+    result->dispatch = dispatch;
+
+    DBG("Loaded image %s (%d rules, %d clauses)\n", filename, header->numberOfRules, header->numberOfClauses);
+    return result;
+}
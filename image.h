@@ -0,0 +1,27 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "structures.h"
+
+// first bytes of every compiled image
+#define IMAGE_MAGIC "RBEC"
+
+// bumped whenever the layout of an image changes
+#define IMAGE_VERSION 5
+
+// reads back differently on a machine with another byte order
+#define IMAGE_BYTE_ORDER 0x01020304
+
+// write a compiled Engine to a file as an image
+int Image_write(Engine* engine, char* filename);
+
+// check whether a file is a compiled image
+int Image_isImage(char* filename);
+
+// map an image read only and build an Engine that executes straight from it
+Engine* Image_load(char* filename);
+
+// unmap the image of an Engine and free the Engine
+int Image_free(Engine* engine);
+
+#endif
@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "sequence.h"
+#include "context.h"
+#include "engine.h"
+#include "image.h"
+#include "parallel.h"
+#include "librbe.h"
+
+///////////////////////////////////////////
+// Private Functions
+
+RbeEngine* Rbe_wrap(Engine* engine){
+    RbeEngine* result = (RbeEngine*) malloc(sizeof(RbeEngine));
+    result->engine = engine;
+    pthread_mutex_init(&result->lock, NULL);
+    result->numberOfIdleContexts = 0;
+    result->idleCapacity = 0;
+    result->idleContexts = NULL;
+    return result;
+}
+
+// take an idle Context (or create one when every Context is in use)
+// (a new Context copies the engine's limits, so it is created under the lock Rbe_setLimits takes)
+Context* Rbe_takeContext(RbeEngine* instance){
+    Context* context = NULL;
+    pthread_mutex_lock(&instance->lock);
+    if (instance->numberOfIdleContexts > 0){
+        instance->numberOfIdleContexts--;
+        context = instance->idleContexts[instance->numberOfIdleContexts];
+    } else {
+        context = Context_init(instance->engine);
+    }
+    pthread_mutex_unlock(&instance->lock);
+    return context;
+}
+
+// give a Context back for the next call
+int Rbe_returnContext(RbeEngine* instance, Context* context){
+    pthread_mutex_lock(&instance->lock);
+    if (instance->numberOfIdleContexts == instance->idleCapacity){
+        instance->idleCapacity = instance->idleCapacity ? instance->idleCapacity * 2 : 8;
+        instance->idleContexts = (Context**) realloc(instance->idleContexts, sizeof(Context*) * instance->idleCapacity);
+    }
+    instance->idleContexts[instance->numberOfIdleContexts] = context;
+    instance->numberOfIdleContexts++;
+    pthread_mutex_unlock(&instance->lock);
+    return 0;
+}
+
+// free every idle Context
+int Rbe_freeIdleContexts(RbeEngine* instance){
+    pthread_mutex_lock(&instance->lock);
+    for (int i=0; i<instance->numberOfIdleContexts; i++){
+        Context_free(instance->idleContexts[i]);
+    }
+    instance->numberOfIdleContexts = 0;
+    pthread_mutex_unlock(&instance->lock);
+    return 0;
+}
+
+
+///////////////////////////////////////////
+// Public Functions
+
+// the RBE_API_VERSION the library was built with
+int Rbe_apiVersion(void){
+    return RBE_API_VERSION;
+}
+
+// compile rule database files (or load a single compiled image) into an engine
+RbeEngine* Rbe_engineFromFiles(int numberOfFiles, const char** filenames){
+    if (numberOfFiles == 1 && Image_isImage((char*) filenames[0])){
+        return Rbe_wrap(Image_load((char*) filenames[0]));
+    }
+    return Rbe_wrap(Engine_init(numberOfFiles, (char**) filenames, Parallel_processors()));
+}
+
+// compile a rule database held in memory into an engine
+RbeEngine* Rbe_engineFromString(const char* rules){
+    char* databaseStrings[1] = {(char*) rules};
+    return Rbe_wrap(Engine_initFromStrings(1, databaseStrings, Parallel_processors()));
+}
+
+// stop every later call at these limits (0 = no limit)
+// (calls already executing keep the limits they started with)
+int Rbe_setLimits(RbeEngine* engine, long microseconds, int passes, long substitutions){
+    if (microseconds < 0 || passes < 0 || substitutions < 0){
+        return -1;
+    }
+    pthread_mutex_lock(&engine->lock);
+    engine->engine->limits.nanoseconds = microseconds * 1000;
+    engine->engine->limits.passes = passes;
+    engine->engine->limits.substitutions = substitutions;
+    pthread_mutex_unlock(&engine->lock);
+    return 0;
+}
+
+// make room for the ids of numberOfTokens input tokens
+int Rbe_reserveTokens(Context* context, int numberOfTokens){
+    if (numberOfTokens > context->inputCapacity){
+        context->inputCapacity = numberOfTokens * 2;
+        context->inputTokens = (int*) realloc(context->inputTokens, sizeof(int) * context->inputCapacity);
+    }
+    return 0;
+}
+
+// execute the engine on the interned input tokens of a Context and copy out the result
+// limits = the limits of this call (NULL = the engine's)
+RbeResult* Rbe_run(RbeEngine* engine, Context* context, int numberOfTokens, int metric, int direction, Limits* limits){
+    if (limits != NULL){
+        context->limits = *limits;
+    } else {
+        pthread_mutex_lock(&engine->lock);
+        context->limits = engine->engine->limits;
+        pthread_mutex_unlock(&engine->lock);
+    }
+    Sequence* sequence = Sequence_init(context->inputTokens, numberOfTokens);
+    int partial = Engine_execute(engine->engine, context, sequence, metric, direction);
+
+    // the result, its token pointers and the token strings share one allocation
+    int length = SEQUENCE_LENGTH(sequence);
+    size_t textLength = 0;
+    for (int i=0; i<length; i++){
+        textLength += strlen(Context_lookup(context, SEQUENCE_GET(sequence, i))) + 1;
+    }
+    RbeResult* output = (RbeResult*) malloc(sizeof(RbeResult) + sizeof(char*) * length + textLength);
+    output->numberOfTokens = length;
+    output->tokens = (char**) (output + 1);
+    output->textLength = textLength;
+    output->partial = partial;
+    char* text = (char*) (output->tokens + length);
+    for (int i=0; i<length; i++){
+        char* token = Context_lookup(context, SEQUENCE_GET(sequence, i));
+        size_t tokenLength = strlen(token) + 1;
+        memcpy(text, token, tokenLength);
+        output->tokens[i] = text;
+        text += tokenLength;
+    }
+
+    Sequence_free(sequence);
+    Rbe_returnContext(engine, context);
+    return output;
+}
+
+// rewrite an array of NUL terminated tokens
+int Rbe_execute(RbeEngine* engine, int metric, int direction, int numberOfTokens, const char** tokens, RbeResult** result){
+    *result = NULL;
+    if (metric < 0 || (direction != -1 && direction != 1) || numberOfTokens < 0){
+        return -1;
+    }
+
+    Context* context = Rbe_takeContext(engine);
+    Context_clearSymbols(context);
+    Rbe_reserveTokens(context, numberOfTokens);
+    for (int i=0; i<numberOfTokens; i++){
+        context->inputTokens[i] = Context_intern(context, (char*) tokens[i], strlen(tokens[i]));
+    }
+
+    *result = Rbe_run(engine, context, numberOfTokens, metric, direction, NULL);
+    return 0;
+}
+
+// rewrite packed tokens (limits = the limits of this call, NULL = the engine's)
+int Rbe_runPacked(RbeEngine* engine, int metric, int direction, const char* tokens, size_t length, Limits* limits, RbeResult** result){
+    *result = NULL;
+    if (metric < 0 || (direction != -1 && direction != 1) || (length > 0 && tokens[length - 1] != '\0')){
+        return -1;
+    }
+
+    Context* context = Rbe_takeContext(engine);
+    Context_clearSymbols(context);
+    int numberOfTokens = 0;
+    size_t tokenStart = 0;
+    for (size_t i=0; i<length; i++){
+        if (tokens[i] != '\0'){
+            continue;
+        }
+        Rbe_reserveTokens(context, numberOfTokens + 1);
+        context->inputTokens[numberOfTokens] = Context_intern(context, (char*) tokens + tokenStart, i - tokenStart);
+        numberOfTokens++;
+        tokenStart = i + 1;
+    }
+
+    *result = Rbe_run(engine, context, numberOfTokens, metric, direction, limits);
+    return 0;
+}
+
+// rewrite tokens packed back to back, each followed by a NUL (length bytes in all)
+int Rbe_executePacked(RbeEngine* engine, int metric, int direction, const char* tokens, size_t length, RbeResult** result){
+    return Rbe_runPacked(engine, metric, direction, tokens, length, NULL, result);
+}
+
+// Rbe_executePacked with limits for this call only in place of the engine's
+int Rbe_executePackedLimited(RbeEngine* engine, int metric, int direction, const char* tokens, size_t length, long microseconds, int passes, long substitutions, RbeResult** result){
+    if (microseconds < 0 || passes < 0 || substitutions < 0){
+        *result = NULL;
+        return -1;
+    }
+    Limits limits = {microseconds * 1000, passes, substitutions};
+    return Rbe_runPacked(engine, metric, direction, tokens, length, &limits, result);
+}
+
+// number of tokens in a result
+int Rbe_resultLength(RbeResult* result){
+    return result->numberOfTokens;
+}
+
+// token i of a result (valid until the result is freed)
+const char* Rbe_resultToken(RbeResult* result, int i){
+    return result->tokens[i];
+}
+
+// 1 if a limit stopped the rewrite of a result before its fixpoint, else 0
+int Rbe_resultPartial(RbeResult* result){
+    return result->partial;
+}
+
+// every token of a result back to back, each followed by a NUL (*length = bytes in all)
+const char* Rbe_resultPacked(RbeResult* result, size_t* length){
+    *length = result->textLength;
+    return (const char*) (result->tokens + result->numberOfTokens);
+}
+
+// free a result
+void Rbe_resultFree(RbeResult* result){
+    free(result);
+}
+
+// free an engine (no call may still be executing it)
+void Rbe_engineFree(RbeEngine* engine){
+    Rbe_freeIdleContexts(engine);
+    free(engine->idleContexts);
+    pthread_mutex_destroy(&engine->lock);
+    Engine_free(engine->engine);
+    free(engine);
+}
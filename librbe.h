@@ -0,0 +1,71 @@
+#ifndef LIBRBE_H
+#define LIBRBE_H
+
+// Public interface of librbe.so (build it with make library)
+// Every type is an opaque handle, so the layout of the engine can change without breaking callers.
+// An RbeEngine may be executed from many threads at once.
+// Databases that do not parse print an error and exit, the same as the rbe program.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RBE_API __attribute__((visibility("default")))
+
+// bumped whenever a function changes in a way that breaks callers
+#define RBE_API_VERSION 1
+
+typedef struct RbeEngine RbeEngine;
+typedef struct RbeResult RbeResult;
+
+// the RBE_API_VERSION the library was built with
+RBE_API int Rbe_apiVersion(void);
+
+// compile rule database files (or load a single compiled image) into an engine
+RBE_API RbeEngine* Rbe_engineFromFiles(int numberOfFiles, const char** filenames);
+
+// compile a rule database held in memory into an engine
+RBE_API RbeEngine* Rbe_engineFromString(const char* rules);
+
+// stop every later call once it has run for microseconds, made passes passes or made substitutions substitutions
+// (0 = no limit) and return the tokens reached so far, marked partial (the --deadline-us, --max-passes and --max-substitutions options)
+// May be called while other threads execute the engine: the calls already executing keep their limits.
+RBE_API int Rbe_setLimits(RbeEngine* engine, long microseconds, int passes, long substitutions);
+
+// rewrite an array of NUL terminated tokens
+// returns 0 and stores the rewritten tokens in *result (free it with Rbe_resultFree)
+// or -1 when the metric is negative or the direction is not -1 or 1
+RBE_API int Rbe_execute(RbeEngine* engine, int metric, int direction, int numberOfTokens, const char** tokens, RbeResult** result);
+
+// rewrite tokens packed back to back, each followed by a NUL (length bytes in all)
+// (one buffer instead of an array of pointers, which is cheaper to build from other languages)
+RBE_API int Rbe_executePacked(RbeEngine* engine, int metric, int direction, const char* tokens, size_t length, RbeResult** result);
+
+// Rbe_executePacked with limits for this call only in place of the engine's (see Rbe_setLimits)
+RBE_API int Rbe_executePackedLimited(RbeEngine* engine, int metric, int direction, const char* tokens, size_t length, long microseconds, int passes, long substitutions, RbeResult** result);
+
+// number of tokens in a result
+RBE_API int Rbe_resultLength(RbeResult* result);
+
+// token i of a result (valid until the result is freed)
+RBE_API const char* Rbe_resultToken(RbeResult* result, int i);
+
+// 1 if a limit stopped the rewrite of a result before its fixpoint, else 0
+RBE_API int Rbe_resultPartial(RbeResult* result);
+
+// every token of a result back to back, each followed by a NUL (*length = bytes in all)
+RBE_API const char* Rbe_resultPacked(RbeResult* result, size_t* length);
+
+// free a result
+RBE_API void Rbe_resultFree(RbeResult* result);
+
+// free an engine (no call may still be executing it)
+RBE_API void Rbe_engineFree(RbeEngine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "sequence.h"
+#include "arena.h"
+#include "memo.h"
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new Memo with numberOfBuckets buckets (a power of 2)
+Memo* Memo_init(int numberOfBuckets){
+    Memo* result = (Memo*) malloc(sizeof(Memo));
+    result->numberOfBuckets = numberOfBuckets;
+    result->buckets = (MemoEntry**) calloc(numberOfBuckets, sizeof(MemoEntry*));
+    result->numberOfEntries = 0;
+    return result;
+}
+
+// forget every segment (the entries live in the arena of the request)
+int Memo_reset(Memo* instance){
+    if (instance->numberOfEntries > 0){
+        memset(instance->buckets, 0, sizeof(MemoEntry*) * instance->numberOfBuckets);
+        instance->numberOfEntries = 0;
+    }
+    return 0;
+}
+
+// hash tokens[start, start+length) of a Sequence
+uint64_t Memo_hash(Sequence* tokens, int start, int length){
+    uint64_t hash = 14695981039346656037ull;
+    for (int i=start; i<start+length; i++){
+        hash = (hash ^ (uint64_t) (unsigned int) SEQUENCE_GET(tokens, i)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// find the normal form of tokens[start, start+length) (NULL = not memoized)
+MemoEntry* Memo_find(Memo* instance, uint64_t hash, Sequence* tokens, int start, int length){
+    MemoEntry* entry = instance->buckets[hash & (instance->numberOfBuckets - 1)];
+    while (entry != NULL){
+        if (entry->hash == hash && entry->length == length){
+            int i = 0;
+            while (i < length && entry->segment[i] == SEQUENCE_GET(tokens, start + i)){
+                i++;
+            }
+            if (i == length){
+                return entry;
+            }
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+// remember the normal form of a segment (both arrays are copied into arena)
+MemoEntry* Memo_insert(Memo* instance, Arena* arena, uint64_t hash, int* segment, int length, int* normalForm, int normalLength){
+    MemoEntry* entry = (MemoEntry*) Arena_alloc(arena, sizeof(MemoEntry));
+    entry->hash = hash;
+    entry->length = length;
+    entry->segment = (int*) Arena_alloc(arena, sizeof(int) * length);
+    memcpy(entry->segment, segment, sizeof(int) * length);
+    entry->normalLength = normalLength;
+    entry->normalForm = (int*) Arena_alloc(arena, sizeof(int) * normalLength);
+    memcpy(entry->normalForm, normalForm, sizeof(int) * normalLength);
+
+    MemoEntry** bucket = &instance->buckets[hash & (instance->numberOfBuckets - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    instance->numberOfEntries++;
+    return entry;
+}
+
+// free a Memo
+int Memo_free(Memo* instance){
+    free(instance->buckets);
+    free(instance);
+    return 0;
+}
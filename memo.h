@@ -0,0 +1,24 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "structures.h"
+
+// initialize a new Memo with numberOfBuckets buckets (a power of 2)
+Memo* Memo_init(int numberOfBuckets);
+
+// forget every segment (the entries live in the arena of the request)
+int Memo_reset(Memo* instance);
+
+// hash tokens[start, start+length) of a Sequence
+uint64_t Memo_hash(Sequence* tokens, int start, int length);
+
+// find the normal form of tokens[start, start+length) (NULL = not memoized)
+MemoEntry* Memo_find(Memo* instance, uint64_t hash, Sequence* tokens, int start, int length);
+
+// remember the normal form of a segment (both arrays are copied into arena)
+MemoEntry* Memo_insert(Memo* instance, Arena* arena, uint64_t hash, int* segment, int length, int* normalForm, int normalLength);
+
+// free a Memo
+int Memo_free(Memo* instance);
+
+#endif
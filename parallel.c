@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "parallel.h"
+
+///////////////////////////////////////////
+// Private Functions
+
+// take indices until every index is taken
+void* Parallel_work(void* argument){
+    ParallelWorker* worker = (ParallelWorker*) argument;
+    ParallelFor* loop = worker->loop;
+    while (1){
+        int index = __atomic_fetch_add(&loop->next, 1, __ATOMIC_RELAXED);
+        if (index >= loop->count){
+            return NULL;
+        }
+        loop->body(loop->data, index, worker->worker);
+    }
+}
+
+///////////////////////////////////////////
+// Public Functions
+
+// call body(data, index, worker) for every index in [0, count) on numberOfThreads threads
+// worker is the number of the thread running the call (0 to numberOfThreads-1)
+// with one thread (or one index) every call runs on the calling thread
+int Parallel_for(int numberOfThreads, int count, void (*body)(void* data, int index, int worker), void* data){
+    if (numberOfThreads > count){
+        numberOfThreads = count;
+    }
+    if (numberOfThreads <= 1){
+        for (int i=0; i<count; i++){
+            body(data, i, 0);
+        }
+        return 0;
+    }
+
+    ParallelFor loop = {count, 0, body, data};
+    ParallelWorker* workers = (ParallelWorker*) malloc(sizeof(ParallelWorker) * numberOfThreads);
+
+    // the calling thread is worker 0
+    for (int i=1; i<numberOfThreads; i++){
+        workers[i].loop = &loop;
+        workers[i].worker = i;
+        if (pthread_create(&workers[i].thread, NULL, Parallel_work, &workers[i])){
+            PANIC("Could not start thread %d\n", i);
+        }
+    }
+    workers[0].loop = &loop;
+    workers[0].worker = 0;
+    Parallel_work(&workers[0]);
+
+    for (int i=1; i<numberOfThreads; i++){
+        pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+    return 0;
+}
+
+// number of processors online
+int Parallel_processors(){
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors < 1 ? 1 : (int) processors;
+}
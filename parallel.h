@@ -0,0 +1,14 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "structures.h"
+
+// call body(data, index, worker) for every index in [0, count) on numberOfThreads threads
+// worker is the number of the thread running the call (0 to numberOfThreads-1)
+// with one thread (or one index) every call runs on the calling thread
+int Parallel_for(int numberOfThreads, int count, void (*body)(void* data, int index, int worker), void* data);
+
+// number of processors online
+int Parallel_processors();
+
+#endif
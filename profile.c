@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "profile.h"
+
+///////////////////////////////////////////
+// Public Functions
+
+// read a profile file (NULL if it cannot be read)
+Profile* Profile_read(char* filename){
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL){
+        return NULL;
+    }
+
+    char magic[16];
+    int version;
+    int numberOfRules;
+    if (fscanf(fp, "%15s %d %d", magic, &version, &numberOfRules) != 3 || strcmp(magic, PROFILE_MAGIC) != 0 || version != PROFILE_VERSION || numberOfRules < 0){
+        fclose(fp);
+        return NULL;
+    }
+
+    Profile* result = (Profile*) malloc(sizeof(Profile));
+    result->numberOfRules = numberOfRules;
+    result->rules = (RuleProfile*) calloc(numberOfRules + 1, sizeof(RuleProfile));
+    for (int i=0; i<numberOfRules; i++){
+        int rule;
+        RuleProfile* profile = &result->rules[i];
+        if (fscanf(fp, "%d %d %ld %ld %ld %ld %ld", &rule, &profile->numberOfClauses, &profile->attempts, &profile->steps, &profile->matches, &profile->substitutions, &profile->substitutionPasses) != 7 || rule != i){
+            Profile_free(result);
+            fclose(fp);
+            return NULL;
+        }
+    }
+    fclose(fp);
+    DBG("Read the profile of %d rules\n", numberOfRules);
+    return result;
+}
+
+// check whether a profile was written for the databases of an Engine (the same rules with the same number of clauses)
+int Profile_matches(Profile* instance, Engine* engine){
+    if (instance->numberOfRules != engine->numberOfCompiledRules){
+        return 0;
+    }
+    for (int i=0; i<engine->numberOfCompiledRules; i++){
+        Rule* rule = engine->compiledRules[i];
+        if (instance->rules[rule->number].numberOfClauses != rule->numberOfClauses){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// free a Profile
+int Profile_free(Profile* instance){
+    free(instance->rules);
+    free(instance);
+    return 0;
+}
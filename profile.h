@@ -0,0 +1,26 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "structures.h"
+
+// A profile file (written by Stats_writeProfile) is a text file:
+//     rbe-profile <version> <number of rules>
+// then one line per rule in database order:
+//     <rule> <number of clauses> <attempts> <steps> <matches> <substitutions> <substitution passes>
+// (substitution passes = the passes the substitutions were made on added up)
+
+#define PROFILE_MAGIC "rbe-profile"
+
+// bumped whenever the format of a profile changes
+#define PROFILE_VERSION 1
+
+// read a profile file (NULL if it cannot be read)
+Profile* Profile_read(char* filename);
+
+// check whether a profile was written for the databases of an Engine (the same rules with the same number of clauses)
+int Profile_matches(Profile* instance, Engine* engine);
+
+// free a Profile
+int Profile_free(Profile* instance);
+
+#endif
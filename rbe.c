@@ -26,6 +26,11 @@ The rule database should be made of Rules
             Metric value of _ is equivalent to -1 (empty)
     # starts a single line comment when outside of quotes
 
+The rule database can also declare bracket pairs (each open token followed by its close token):
+    @brackets "(" ")" "[" "]";
+    Every balanced segment between a pair is rewritten on its own, innermost first, before the whole input.
+    A segment that repeats within the same input reuses the first copy's result.
+
  
 */
 
@@ -37,7 +42,17 @@ The rule database should be made of Rules
 #include "debug.h"
 #include "structures.h"
 
+#include "context.h"
 #include "engine.h"
+#include "batch.h"
+#include "image.h"
+#include "parallel.h"
+#include "cache.h"
+#include "server.h"
+#include "frame.h"
+#include "stats.h"
+#include "trace.h"
+#include "profile.h"
 
 int numberOfDatabaseFiles;
 char** databaseFilenames;
@@ -45,33 +60,177 @@ char** databaseFilenames;
 int cliMetric;
 int cliDirection;
 
+int cliThreads = 0;
+char* cliCompile = NULL;
+int cliCacheEntries = 0;
+long cliCacheBytes = 0;
+char* cliServe = NULL;
+int cliBinary = 0;
+int cliStats = 0;
+int cliTimeClauses = 0;
+char* cliSnapshot = NULL;
+int cliSnapshotInterval = 10;
+int cliExplain = 0;
+long cliDeadline = 0;
+int cliMaxPasses = 0;
+long cliMaxSubstitutions = 0;
+char* cliWriteProfile = NULL;
+char* cliUseProfile = NULL;
+int cliPreserveOrder = 0;
+
 
 int printUsage(){
     printf("Usage:\n");
-    printf("\t./rbe <metric> <direction> <rule_database1> <rule_database2> ... <rule_databaseN>\n");
+    printf("\t./rbe [options] <metric> <direction> <rule_database1> <rule_database2> ... <rule_databaseN>\n");
+    printf("\t./rbe --compile <image> <rule_database1> <rule_database2> ... <rule_databaseN>\n");
+    printf("\t./rbe [options] --serve <socket> <rule_database1> <rule_database2> ... <rule_databaseN>\n");
+    printf("\t./rbe [options] --binary <rule_database1> <rule_database2> ... <rule_databaseN>\n");
+    printf("Options:\n");
+    printf("\t--threads N\texecute lines on N worker threads (results keep the input order)\n");
+    printf("\t--cache-entries N\tcache the results of the N most recently used lines\n");
+    printf("\t--cache-bytes N\tkeep the cached results under N bytes\n");
+    printf("\t--serve S\tanswer requests \"<metric> <direction> <tokens...>\" on the Unix socket S (--threads sets the workers)\n");
+    printf("\t--binary\trequests and responses are length prefixed frames that carry their own metric and direction (see frame.h)\n");
+    printf("\t--stats\tprint the counters of every thread and the costliest rules and the peak memory on stderr at exit (SIGUSR1 prints the counters at any time)\n");
+    printf("\t--time-clauses\talso time every rule and clause (ranks the rules by time instead of steps)\n");
+    printf("\t--explain\tprint the substitutions that rewrote each line on stderr (on one thread, without the cache)\n");
+    printf("\t--deadline-us N\tstop rewriting a line after N microseconds and answer with the tokens reached so far, marked partial\n");
+    printf("\t--max-passes N\tstop rewriting a line after N passes (marked partial)\n");
+    printf("\t--max-substitutions N\tstop rewriting a line after N substitutions (marked partial)\n");
+    printf("\t--snapshot F\trewrite the totals and the latency, pass, substitution and token count histograms to F as JSON every few seconds and at exit\n");
+    printf("\t--snapshot-interval N\trewrite the snapshot every N seconds (10 by default)\n");
+    printf("\t--write-profile F\twrite how often every rule was tried and made substitutions to F at exit\n");
+    printf("\t--use-profile F\ttry the rules whose substitutions came on the earliest passes in the profile F first and those that made none last (this can change results)\n");
+    printf("\t--preserve-order\talways try the rules in database order, so results never depend on a profile\n");
+    printf("\t--compile F\twrite the compiled databases to the image F (pass F in place of the databases to load it)\n");
 
     return 0;
 }
 
 
 int parseCliArgs(int argc, char** argv){
-    if (argc < 4){
+    // options come before the metric
+    int argIndex = 1;
+    while (argIndex < argc && !strncmp(argv[argIndex], "--", 2)){
+        if (!strcmp(argv[argIndex], "--threads") && argIndex + 1 < argc){
+            argIndex++;
+            cliThreads = atoi(argv[argIndex]);
+            if (cliThreads < 1){
+                printf("Number of threads must be a positive integer.\n");
+                printUsage();
+                return 1;
+            }
+        } else if (!strcmp(argv[argIndex], "--cache-entries") && argIndex + 1 < argc){
+            argIndex++;
+            cliCacheEntries = atoi(argv[argIndex]);
+            if (cliCacheEntries < 1){
+                printf("Number of cache entries must be a positive integer.\n");
+                printUsage();
+                return 1;
+            }
+        } else if (!strcmp(argv[argIndex], "--cache-bytes") && argIndex + 1 < argc){
+            argIndex++;
+            cliCacheBytes = atol(argv[argIndex]);
+            if (cliCacheBytes < 1){
+                printf("Number of cache bytes must be a positive integer.\n");
+                printUsage();
+                return 1;
+            }
+        } else if (!strcmp(argv[argIndex], "--serve") && argIndex + 1 < argc){
+            argIndex++;
+            cliServe = argv[argIndex];
+        } else if (!strcmp(argv[argIndex], "--stats")){
+            cliStats = 1;
+        } else if (!strcmp(argv[argIndex], "--time-clauses")){
+            cliTimeClauses = 1;
+        } else if (!strcmp(argv[argIndex], "--explain")){
+            cliExplain = 1;
+        } else if (!strcmp(argv[argIndex], "--deadline-us") && argIndex + 1 < argc){
+            argIndex++;
+            cliDeadline = atol(argv[argIndex]);
+            if (cliDeadline < 1){
+                printf("Deadline must be a positive number of microseconds.\n");
+                printUsage();
+                return 1;
+            }
+        } else if (!strcmp(argv[argIndex], "--max-passes") && argIndex + 1 < argc){
+            argIndex++;
+            cliMaxPasses = atoi(argv[argIndex]);
+            if (cliMaxPasses < 1){
+                printf("Maximum number of passes must be a positive integer.\n");
+                printUsage();
+                return 1;
+            }
+        } else if (!strcmp(argv[argIndex], "--max-substitutions") && argIndex + 1 < argc){
+            argIndex++;
+            cliMaxSubstitutions = atol(argv[argIndex]);
+            if (cliMaxSubstitutions < 1){
+                printf("Maximum number of substitutions must be a positive integer.\n");
+                printUsage();
+                return 1;
+            }
+        } else if (!strcmp(argv[argIndex], "--snapshot") && argIndex + 1 < argc){
+            argIndex++;
+            cliSnapshot = argv[argIndex];
+        } else if (!strcmp(argv[argIndex], "--snapshot-interval") && argIndex + 1 < argc){
+            argIndex++;
+            cliSnapshotInterval = atoi(argv[argIndex]);
+            if (cliSnapshotInterval < 1){
+                printf("Snapshot interval must be a positive integer.\n");
+                printUsage();
+                return 1;
+            }
+        } else if (!strcmp(argv[argIndex], "--write-profile") && argIndex + 1 < argc){
+            argIndex++;
+            cliWriteProfile = argv[argIndex];
+        } else if (!strcmp(argv[argIndex], "--use-profile") && argIndex + 1 < argc){
+            argIndex++;
+            cliUseProfile = argv[argIndex];
+        } else if (!strcmp(argv[argIndex], "--preserve-order")){
+            cliPreserveOrder = 1;
+        } else if (!strcmp(argv[argIndex], "--binary")){
+            cliBinary = 1;
+        } else if (!strcmp(argv[argIndex], "--compile") && argIndex + 1 < argc){
+            argIndex++;
+            cliCompile = argv[argIndex];
+        } else {
+            printf("Unknown option: %s\n", argv[argIndex]);
+            printUsage();
+            return 1;
+        }
+        DBG("Option added: %s\n", argv[argIndex]);
+        argIndex++;
+    }
+
+    // compiling, serving and frames only take the databases (requests carry their own metric and direction)
+    if (cliCompile != NULL || cliServe != NULL || cliBinary){
+        if (argc - argIndex < 1){
+            printf("Not enough args supplied.\n");
+            printUsage();
+            return 1;
+        }
+        numberOfDatabaseFiles = argc - argIndex;
+        databaseFilenames = argv + argIndex;
+        return 0;
+    }
+
+    if (argc - argIndex < 3){
         printf("Not enough args supplied.\n");
         printUsage();
         return 1;
     }
 
-    numberOfDatabaseFiles = argc - 3;
+    numberOfDatabaseFiles = argc - argIndex - 2;
     databaseFilenames = (char**) malloc(sizeof(char*) * numberOfDatabaseFiles);
 
-    cliMetric = atoi(argv[1]);
+    cliMetric = atoi(argv[argIndex]);
     if (cliMetric < 0){
         printf("Metric must be a non-negative integer.\n");
         printUsage();
         return 1;
     }
 
-    cliDirection = atoi(argv[2]);
+    cliDirection = atoi(argv[argIndex+1]);
     switch(cliDirection){
         case -1:
         case 1:
@@ -82,8 +241,8 @@ int parseCliArgs(int argc, char** argv){
             return 1;
     }
 
-    for (int i=3; i<argc; i++){
-        databaseFilenames[i-3] = argv[i];
+    for (int i=argIndex+2; i<argc; i++){
+        databaseFilenames[i-argIndex-2] = argv[i];
         DBG("Database file added: %s\n", argv[i]);
     }
 
@@ -91,6 +250,46 @@ int parseCliArgs(int argc, char** argv){
 }
 
 
+// print the peak resident memory of this process (VmHWM, which starts over at exec unlike ru_maxrss)
+int reportPeakMemory(FILE* fp){
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == NULL){
+        return 1;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), status) != NULL){
+        long kilobytes;
+        if (sscanf(line, "VmHWM: %ld kB", &kilobytes) == 1){
+            fprintf(fp, "memory: %ld KB peak resident\n", kilobytes);
+            break;
+        }
+    }
+    fclose(status);
+    return 0;
+}
+
+// report and free what every way of answering requests shares once the input is done
+int finish(Cache* cache, Stats* stats){
+    if (cache != NULL){
+        Cache_report(cache, stderr);
+        Cache_free(cache);
+    }
+    if (cliStats){
+        Stats_report(stats, stderr);
+        reportPeakMemory(stderr);
+    }
+    // the last snapshot covers every request
+    if (cliSnapshot != NULL){
+        Stats_writeSnapshotFile(stats);
+    }
+    if (cliWriteProfile != NULL && Stats_writeProfile(stats, cliWriteProfile)){
+        fprintf(stderr, "Could not write the rule profile %s\n", cliWriteProfile);
+    }
+    Stats_free(stats);
+    return 0;
+}
+
+
 // Take in command line args to get the filenames of all rule databases to compile
 // After that, start accepting standard input as input to the rule based engine
 int main(int argc, char** argv){
@@ -102,82 +301,139 @@ int main(int argc, char** argv){
     }
 
     DBG("Creating Engine...\n");
-    Engine* engine = Engine_init(numberOfDatabaseFiles, databaseFilenames);
-
-    DBG("Rule Based Engine is fully initialized!\n");
-
-    DBG("Awaiting input tokens...\n");
-
-
-    while (1){
-        char* line = NULL;
-        size_t lineLength;
-
-        size_t bytesRead = getline(&line, &lineLength, stdin);
-
-        // EOF reached
-        if (bytesRead == -1){
-            free(line);
-            return 0;
+    // the databases are compiled (and requests served) on every processor unless --threads says otherwise
+    int numberOfThreads = cliThreads > 0 ? cliThreads : Parallel_processors();
+
+    // the rule order of a profile is compiled into images too
+    Profile* profile = NULL;
+    if (cliUseProfile != NULL && !cliPreserveOrder){
+        profile = Profile_read(cliUseProfile);
+        if (profile == NULL){
+            printf("Could not read the rule profile %s\n", cliUseProfile);
+            return 1;
         }
+    }
 
-        if (bytesRead > 0){
-            line[bytesRead - 1]  = '\0';
+    Engine* engine;
+    if (cliCompile != NULL){
+        engine = Engine_init(numberOfDatabaseFiles, databaseFilenames, numberOfThreads);
+        if (profile != NULL && Engine_orderRules(engine, profile)){
+            printf("The rule profile %s is of other databases\n", cliUseProfile);
+            return 1;
         }
+        Image_write(engine, cliCompile);
+        return 0;
+    }
 
-        // break the line up into tokens at spaces
-        int numberOfInputTokens = 1;
-        char** inputTokens;
-        for (int i=0; i<bytesRead; i++){
-            if (line[i] == ' '){
-                numberOfInputTokens++;
+    // a compiled image is used in place of the databases
+    if (numberOfDatabaseFiles == 1 && Image_isImage(databaseFilenames[0])){
+        engine = Image_load(databaseFilenames[0]);
+    } else {
+        for (int i=0; i<numberOfDatabaseFiles; i++){
+            if (Image_isImage(databaseFilenames[i])){
+                printf("A compiled image cannot be combined with other databases: %s\n", databaseFilenames[i]);
+                return 1;
             }
         }
+        engine = Engine_init(numberOfDatabaseFiles, databaseFilenames, numberOfThreads);
+    }
+
+    // a stale profile only costs speed, so the rules keep their order
+    if (profile != NULL){
+        if (Engine_orderRules(engine, profile)){
+            fprintf(stderr, "The rule profile %s is of other databases or a compiled image, the rules keep their order\n", cliUseProfile);
+        }
+        Profile_free(profile);
+    }
+    engine->timeClauses = cliTimeClauses;
+    // every Context (of every mode) starts with these limits
+    engine->limits.nanoseconds = cliDeadline * 1000;
+    engine->limits.passes = cliMaxPasses;
+    engine->limits.substitutions = cliMaxSubstitutions;
+
+    DBG("Rule Based Engine is fully initialized!\n");
 
-        inputTokens = (char**) malloc(sizeof(char*) * numberOfInputTokens);
+    // repeated lines are answered from the cache (its counts are reported on stderr at exit)
+    Cache* cache = NULL;
+    if (cliCacheEntries > 0 || cliCacheBytes > 0){
+        cache = Cache_init(cliCacheEntries, cliCacheBytes);
+    }
 
-        DBG("Received input. Parsing...\n");
-        DBG("Input:\n%s\n", line);
-        DBG("Parsing into %d tokens\n", numberOfInputTokens);
+    // the counters of every Context are dumped on stderr on SIGUSR1 (taken by the stats thread only)
+    Stats_blockSignal();
+    Stats* stats = Stats_init(engine);
+    if (cliSnapshot != NULL){
+        Stats_snapshotEvery(stats, cliSnapshot, cliSnapshotInterval);
+    }
+    Stats_listen(stats, stderr);
+
+    // requests come from clients of the socket
+    if (cliServe != NULL){
+        Server* server = Server_init(engine, cliServe, numberOfThreads, cliBinary, cache, stats);
+        Server_run(server);
+        finish(cache, stats);
+        Server_free(server);
+        return 0;
+    }
 
-        int tokenStart = 0;
-        int currentInputToken = 0;
-        for (int i=0; i<bytesRead; i++){
-            if (line[i] == ' '){
-                int tokenLength = i - tokenStart;
-                inputTokens[currentInputToken] = (char*) malloc(sizeof(char) * (tokenLength + 1));
+    // every frame is answered with one write
+    if (cliBinary){
+        Context* context = Context_init(engine);
+        context->cache = cache;
+        Stats_addContext(stats, context);
+        Frame_run(context, stdin, stdout);
+        finish(cache, stats);
+        Context_free(context);
+        return 0;
+    }
 
-                strncpy(inputTokens[currentInputToken], line+tokenStart, tokenLength);
-                inputTokens[currentInputToken][tokenLength] = '\0';
+    // lines are split between workers that share the engine (explained lines are executed in order on this thread)
+    if (cliThreads > 0 && !cliExplain){
+        Batch* batch = Batch_init(engine, cliThreads, cliMetric, cliDirection, cache, stats);
+        Batch_run(batch, stdin, stdout);
+        finish(cache, stats);
+        Batch_free(batch);
+        return 0;
+    }
 
-                tokenStart = i + 1;
-                currentInputToken++;
-            }
-        }
-        int tokenLength = bytesRead - tokenStart;
-        inputTokens[currentInputToken] = (char*) malloc(sizeof(char) * (tokenLength + 1));
+    Context* context = Context_init(engine);
+    context->cache = cache;
+    Stats_addContext(stats, context);
 
-        strncpy(inputTokens[currentInputToken], line+tokenStart, tokenLength);
-        inputTokens[currentInputToken][tokenLength] = '\0';
+    // every line is executed so it can be explained
+    if (cliExplain){
+        context->cache = NULL;
+        Context_setTracing(context, 1);
+    }
 
-        
-        DBG("Executing engine on input...\n");
+    DBG("Awaiting input tokens...\n");
 
-        int newLength;
-        char** result = Engine_execute(engine, inputTokens, numberOfInputTokens, cliMetric, cliDirection, &newLength);
+    // the line buffer and output are reused for every line
+    char* line = NULL;
+    size_t lineLength = 0;
+    OutputBuffer output = {NULL, 0, 0};
 
-        DBG("FINAL RESULT:\n");
-        for (int i=0; i<newLength; i++){
-            printf("%s ", result[i]);
+    while (1){
+        ssize_t bytesRead = getline(&line, &lineLength, stdin);
+
+        // EOF reached
+        if (bytesRead == -1){
+            free(line);
+            free(output.bytes);
+            finish(cache, stats);
+            Context_free(context);
+            return 0;
         }
-        printf("\n");
 
+        output.length = 0;
+        Batch_executeLine(context, line, bytesRead, cliMetric, cliDirection, &output);
+
+        fwrite(output.bytes, 1, output.length, stdout);
         fflush(stdout);
-        free(line);
-        free(inputTokens);
+        if (cliExplain){
+            Trace_explain(context->trace, engine, stderr);
+        }
     }
 
     return 0;
 }
-
-
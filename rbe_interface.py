@@ -3,9 +3,27 @@ This program's purpose is to communicate with the rule based engine
 and provide simple functions that allow interfacing with it using python
 """
 
+import json
 import subprocess
+import socket
+import struct
+import ctypes
 
 RBE_BINARY = "./rbe"
+RBE_LIBRARY = "./librbe.so"
+
+# a result line the engine's limits cut short starts with this
+PARTIAL_PREFIX = "partial: "
+
+class PartialResult(list):
+    # the tokens reached before a limit (deadline, passes or substitutions) stopped the rewrite
+    partial = True
+
+def limit_words(limits):
+    # {"deadline-us": 500, "max-passes": 10, "max-substitutions": 1000} -> "deadline-us=500 max-passes=10 ..."
+    if not limits:
+        return ""
+    return "".join("%s=%d " % (name, value) for name, value in limits.items())
 
 def start_process(database_files:list[str], metric, direction):
 
@@ -27,6 +45,185 @@ def optimize_tokens(process, tokens):
 
     return line.decode().strip()
 
+def connect_server(socket_path):
+    # connect to an engine started with ./rbe --serve <socket_path> <databases>
+    the_socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    the_socket.connect(socket_path)
+    return the_socket.makefile("rwb")
+
+def optimize_tokens_server(connection, tokens, metric, direction, limits=None):
+    # each request carries its own metric and direction (and limits, see limit_words)
+    the_string = limit_words(limits) + str(metric) + " " + str(direction) + " " + " ".join(tokens) + '\n'
+    connection.write(the_string.encode())
+    connection.flush()
+
+    line = connection.readline()
+
+    return line.decode().strip()
+
+def explain_tokens_server(connection, tokens, metric, direction):
+    # the result and the substitutions that produced it (the explanation ends with an empty line)
+    the_string = "explain " + str(metric) + " " + str(direction) + " " + " ".join(tokens) + '\n'
+    connection.write(the_string.encode())
+    connection.flush()
+
+    result = connection.readline().decode().strip()
+    explanation = []
+    while True:
+        line = connection.readline()
+        if not line or line == b"\n":
+            break
+        explanation.append(line.decode().rstrip("\n"))
+
+    return result, explanation
+
+def server_stats(connection):
+    # the counters dump, ended by an empty line
+    connection.write(b"stats\n")
+    connection.flush()
+
+    lines = []
+    while True:
+        line = connection.readline()
+        if not line or line == b"\n":
+            break
+        lines.append(line.decode().rstrip("\n"))
+
+    return lines
+
+def server_snapshot(connection):
+    # the totals and request histograms as a dict
+    connection.write(b"stats json\n")
+    connection.flush()
+
+    line = connection.readline()
+
+    return json.loads(line)
+
+def start_binary_process(database_files:list[str]):
+    # each frame carries the metric and direction of its requests
+    invocation = ["./rbe", "--binary"]
+    for file in database_files:
+        invocation.append(file)
+
+    the_process = subprocess.Popen(invocation, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+
+    return the_process
+
+def connect_binary_server(socket_path):
+    # connect to an engine started with ./rbe --binary --serve <socket_path> <databases>
+    return connect_server(socket_path)
+
+def read_exactly(stream, length):
+    data = stream.read(length)
+    if len(data) != length:
+        raise EOFError("the engine closed the connection")
+    return data
+
+def optimize_batch(stream_in, stream_out, requests):
+    # requests = [(tokens, metric, direction), ...], sent as one frame
+    # returns one list of tokens per request (or raises on an error response)
+    # tokens a limit cut short are returned as a PartialResult
+    body = struct.pack("<I", len(requests))
+    for tokens, metric, direction in requests:
+        body += struct.pack("<iiI", int(metric), int(direction), len(tokens))
+        for token in tokens:
+            encoded = token.encode()
+            body += struct.pack("<I", len(encoded)) + encoded
+    stream_in.write(struct.pack("<I", len(body)) + body)
+    stream_in.flush()
+
+    frame_length, = struct.unpack("<I", read_exactly(stream_out, 4))
+    frame = read_exactly(stream_out, frame_length)
+    count, = struct.unpack_from("<I", frame, 0)
+    position = 4
+    results = []
+    for i in range(count):
+        status, number_of_tokens = struct.unpack_from("<iI", frame, position)
+        position += 8
+        tokens = []
+        for j in range(number_of_tokens):
+            length, = struct.unpack_from("<I", frame, position)
+            position += 4
+            tokens.append(frame[position:position+length].decode())
+            position += length
+        if status == 1:
+            raise ValueError(tokens[0])
+        results.append(PartialResult(tokens) if status == 2 else tokens)
+
+    return results
+
+def optimize_batch_process(process, requests):
+    return optimize_batch(process.stdin, process.stdout, requests)
+
+def optimize_batch_server(connection, requests):
+    return optimize_batch(connection, connection, requests)
+
+def load_library(library_path=RBE_LIBRARY):
+    # in process backend (build the library with make library)
+    library = ctypes.CDLL(library_path)
+    library.Rbe_apiVersion.restype = ctypes.c_int
+    library.Rbe_engineFromFiles.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_char_p)]
+    library.Rbe_engineFromFiles.restype = ctypes.c_void_p
+    library.Rbe_engineFromString.argtypes = [ctypes.c_char_p]
+    library.Rbe_engineFromString.restype = ctypes.c_void_p
+    library.Rbe_execute.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(ctypes.c_void_p)]
+    library.Rbe_execute.restype = ctypes.c_int
+    library.Rbe_executePacked.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_void_p)]
+    library.Rbe_executePacked.restype = ctypes.c_int
+    library.Rbe_setLimits.argtypes = [ctypes.c_void_p, ctypes.c_long, ctypes.c_int, ctypes.c_long]
+    library.Rbe_setLimits.restype = ctypes.c_int
+    library.Rbe_executePackedLimited.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_long, ctypes.c_int, ctypes.c_long, ctypes.POINTER(ctypes.c_void_p)]
+    library.Rbe_executePackedLimited.restype = ctypes.c_int
+    library.Rbe_resultPartial.argtypes = [ctypes.c_void_p]
+    library.Rbe_resultPartial.restype = ctypes.c_int
+    library.Rbe_resultPacked.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+    library.Rbe_resultPacked.restype = ctypes.c_void_p
+    library.Rbe_resultLength.argtypes = [ctypes.c_void_p]
+    library.Rbe_resultLength.restype = ctypes.c_int
+    library.Rbe_resultToken.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    library.Rbe_resultToken.restype = ctypes.c_char_p
+    library.Rbe_resultFree.argtypes = [ctypes.c_void_p]
+    library.Rbe_engineFree.argtypes = [ctypes.c_void_p]
+    return library
+
+def create_engine(library, database_files:list[str]):
+    filenames = (ctypes.c_char_p * len(database_files))(*[file.encode() for file in database_files])
+    return library.Rbe_engineFromFiles(len(database_files), filenames)
+
+def create_engine_from_string(library, rules):
+    return library.Rbe_engineFromString(rules.encode())
+
+def set_limits(library, engine, microseconds=0, passes=0, substitutions=0):
+    # the limits of every later call (0 = no limit)
+    library.Rbe_setLimits(engine, microseconds, passes, substitutions)
+
+def optimize_tokens_library(library, engine, tokens, metric, direction, limits=None):
+    # the tokens are rewritten in this process without any pipe or socket
+    # (they cross over packed in one buffer, each followed by a NUL)
+    # limits = (microseconds, passes, substitutions) for this call only (0 = no limit)
+    packed = "".join(token + "\0" for token in tokens).encode()
+    result = ctypes.c_void_p()
+    if limits is None:
+        status = library.Rbe_executePacked(engine, int(metric), int(direction), packed, len(packed), ctypes.byref(result))
+    else:
+        microseconds, passes, substitutions = limits
+        status = library.Rbe_executePackedLimited(engine, int(metric), int(direction), packed, len(packed), microseconds, passes, substitutions, ctypes.byref(result))
+    if status != 0:
+        raise ValueError("the metric must be non-negative, the direction either -1 or 1 and the limits non-negative")
+
+    length = ctypes.c_size_t()
+    address = library.Rbe_resultPacked(result, ctypes.byref(length))
+    optimized = ctypes.string_at(address, length.value).decode().split("\0")[:-1]
+    if library.Rbe_resultPartial(result):
+        optimized = PartialResult(optimized)
+    library.Rbe_resultFree(result)
+
+    return optimized
+
+def free_engine(library, engine):
+    library.Rbe_engineFree(engine)
+
 
 if __name__ == '__main__':
     database_files = ["test2.rbe"]
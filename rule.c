@@ -7,6 +7,12 @@
 #include "structures.h"
 
 #include "clause.h"
+#include "context.h"
+#include "dispatch.h"
+#include "sequence.h"
+#include "arena.h"
+#include "stats.h"
+#include "trace.h"
 #include "rule.h"
 
 ///////////////////////////////////////////
@@ -129,7 +135,7 @@ int Rule_cacheBestMetrics(Rule* instance){
 
 
 // TODO: make this replace the variables and such
-char** createReplacementString(MatchResult* matchResult, Clause* matchedClause, char** tokens, int numberOfTokens, Clause* bestClause, int* resultLength){
+int* createReplacementString(MatchResult* matchResult, Clause* matchedClause, Sequence* tokens, Clause* bestClause, int* resultLength, Arena* arena){
 
     DBG("Creating replacement String\n");
     DBG("numberOfVariables = %d\n", matchResult->numberOfVariables);
@@ -137,7 +143,7 @@ char** createReplacementString(MatchResult* matchResult, Clause* matchedClause,
         DBG("\tvariable binding length = %d\n", matchResult->variableBindingLengths[i]);
         DBG("\t\t");
         for (int j=0; j<matchResult->variableBindingLengths[i]; j++){
-            DBG("%s, ", matchResult->variableBindings[i][j]);
+            DBG("%d, ", matchResult->variableBindings[i][j]);
         }
         DBG("\n");
     }
@@ -162,7 +168,7 @@ char** createReplacementString(MatchResult* matchResult, Clause* matchedClause,
 
 
 
-    char** replacement = (char**) malloc(sizeof(char*) * replacementLength);
+    int* replacement = (int*) Arena_alloc(arena, sizeof(int) * replacementLength);
     *resultLength = replacementLength;
 
     DBG("Creating replacement string...\n");
@@ -198,107 +204,154 @@ char** createReplacementString(MatchResult* matchResult, Clause* matchedClause,
 }
 
 
-char** Rule_execute(Rule* instance, char** tokens, int numberOfTokens, int metric, int direction, int* substitutions, int* newNumberOfTokens, int startOffset, int startingClause){
-    char** result = tokens;
+// Execute a rule on a Sequence of tokens in place
+// The scan is driven by an explicit loop over (offset, startingClause):
+// a match that is already the best clause moves on to the next clause after it,
+// and a substitution starts over from the first clause after it.
+int Rule_execute(Rule* instance, Sequence* tokens, int metric, int direction, int* substitutions, int startOffset, int startingClause, Context* context){
+    Dispatch* dispatch = context->engine->dispatch;
+    int timeClauses = context->engine->timeClauses;
+    ClauseCounters* counters = &context->clauseCounters[instance->firstClause];
 
     if (metric >= instance->numberOfMetrics){
-        return result;
+        return 0;
     }
 
     if (direction == 0){
-        return result;
+        return 0;
     }
 
-    if (startOffset >= numberOfTokens){
-        DBG("Reached end of tokens for this rule...\n");
-        return result;
+    // find the best replacement clause
+    int bestClause;
+    if (direction < 0){
+        bestClause = instance->minimalMetric[metric];
+    } else {
+        bestClause = instance->maximalMetric[metric];
     }
 
-    DBG("Attempting to match tokens against each clause...\n");
-    // try to match the instance against each clause until a match is found
-    
-    for (int i=startingClause; i<instance->numberOfClauses; i++){
-        DBG("Attempting to match with clause %d\n", i);
-    
-        // need to get the offset, variable bindings, length
-        MatchResult* matchResult = Clause_match(instance->clauses[i], tokens, numberOfTokens, startOffset);
+    int offset = startOffset;
+    int firstClause = startingClause;
+    while (offset < SEQUENCE_LENGTH(tokens) && !context->stopped){
+        // nothing allocated for the previous match is needed anymore
+        ArenaMark mark = Arena_mark(context->arena);
+
+        DBG("Attempting to match tokens against each clause...\n");
+        // try to match the instance against each clause until a match is found
+        MatchResult* matchResult = NULL;
+        int i;
+        for (i=firstClause; i<instance->numberOfClauses; i++){
+            DBG("Attempting to match with clause %d\n", i);
+
+            // the clause's literal run or first symbols do not occur in the tokens
+            if (context->candidates[instance->firstClause + i] != CANDIDATE){
+                continue;
+            }
+            // or one of its required literals does not
+            if (!DISPATCH_FILTER_COVERS(context->presentTokens, &dispatch->requiredLiterals[(instance->firstClause + i) * DISPATCH_FILTER_WORDS])){
+                continue;
+            }
+
+            // need to get the offset, variable bindings, length
+            long start = timeClauses ? Stats_now() : 0;
+            COUNTER_ADD(counters[i].attempts, 1);
+            matchResult = Clause_match(instance->clauses[i], tokens, offset, context, &counters[i]);
+            if (timeClauses){
+                COUNTER_ADD(counters[i].nanoseconds, Stats_now() - start);
+            }
+            if (matchResult != NULL){
+                COUNTER_ADD(counters[i].matches, 1);
+                break;
+            }
+            if (context->stopped){
+                break;
+            }
+        }
+
         if (matchResult == NULL){
-            continue;
+            break;
         }
         DBG("Found a matching clause. Finding the best replacement...\n");
         DBG("MatchResult information:\n");
         DBG("\toffset = %d\n\tlength = %d\n", matchResult->offset, matchResult->length);
 
-        // find the best replacement clause
-        int bestClause;
-        if (direction < 0){
-            bestClause = instance->minimalMetric[metric];
-        } else {
-            bestClause = instance->maximalMetric[metric];
-        }
+        // continue after the match
+        offset = matchResult->offset + matchResult->length;
 
         if (bestClause == i){
             DBG("Already at the best clause... No substitution needed.\n");
-            *newNumberOfTokens = numberOfTokens;
-            return Rule_execute(instance, result, numberOfTokens, metric, direction, substitutions, newNumberOfTokens, matchResult->offset + matchResult->length, i+1);
+            firstClause = i + 1;
+            Arena_rewind(context->arena, mark);
+            continue;
         }
 
         // make sure the best metric is actually better
+        int alreadyBest = 0;
         if (direction < 0){
-            if (instance->clauses[i]->numberOfMetrics > i && instance->clauses[bestClause]->metrics[metric] > instance->clauses[i]->metrics[metric]){
-                DBG("Already at best clause... No substitution needed.\n");
-                *newNumberOfTokens = numberOfTokens;
-                return Rule_execute(instance, result, numberOfTokens, metric, direction, substitutions, newNumberOfTokens, matchResult->offset + matchResult->length, i+1);
-            }
+            alreadyBest = instance->clauses[i]->numberOfMetrics > i && instance->clauses[bestClause]->metrics[metric] > instance->clauses[i]->metrics[metric];
         } else {
-            if (instance->clauses[i]->numberOfMetrics > i && instance->clauses[bestClause]->metrics[metric] < instance->clauses[i]->metrics[metric]){
-                DBG("Already at best clause... No substitution needed.\n");
-                *newNumberOfTokens = numberOfTokens;
-                return Rule_execute(instance, result, numberOfTokens, metric, direction, substitutions, newNumberOfTokens, matchResult->offset + matchResult->length, i+1);
-            }
+            alreadyBest = instance->clauses[i]->numberOfMetrics > i && instance->clauses[bestClause]->metrics[metric] < instance->clauses[i]->metrics[metric];
+        }
+        if (alreadyBest){
+            DBG("Already at best clause... No substitution needed.\n");
+            firstClause = i + 1;
+            Arena_rewind(context->arena, mark);
+            continue;
         }
 
         // substitute the best clause for the current one if the metric is better
         DBG("Substitution needed...\n");
 
         Clause* bestClauseData = instance->clauses[bestClause];
+        long start = timeClauses ? Stats_now() : 0;
 
         // create the replacement string
         int replacementLength;
-        char** replacementString = createReplacementString(matchResult, instance->clauses[i], tokens, numberOfTokens, bestClauseData, &replacementLength);
+        int* replacementString = createReplacementString(matchResult, instance->clauses[i], tokens, bestClauseData, &replacementLength, context->arena);
 
-        int newLength = numberOfTokens - matchResult->length + replacementLength;
-        *newNumberOfTokens = newLength;
-        DBG("Number of tokens: %d -> %d\n", numberOfTokens, newLength);
+        DBG("Number of tokens: %d -> %d\n", SEQUENCE_LENGTH(tokens), SEQUENCE_LENGTH(tokens) - matchResult->length + replacementLength);
 
-        char** substituted = malloc(sizeof(char*) * newLength);
+        Sequence_splice(tokens, matchResult->offset, matchResult->length, replacementString, replacementLength);
         *substitutions += 1;
-
-        int currentSpot = 0;
-        for (int j=0; j<matchResult->offset; j++){
-            substituted[currentSpot] = tokens[j];
-            currentSpot++;
-        }
-        for (int j=0; j<replacementLength; j++){
-            substituted[currentSpot] = replacementString[j];
-            currentSpot++;
+        COUNTER_ADD(counters[i].substitutions, 1);
+        COUNTER_ADD(counters[i].substitutionPasses, context->pass);
+        if (context->substitutionsLeft > 0 && --context->substitutionsLeft == 0){
+            context->stopped = LIMIT_SUBSTITUTIONS;
         }
-        for (int j=matchResult->offset + matchResult->length; j<numberOfTokens; j++){
-            substituted[currentSpot] = tokens[j];
-            currentSpot++;
+        if (context->tracing){
+            Trace_record(context->trace, i, bestClause, matchResult->offset, matchResult->length, replacementLength);
         }
 
+        // the replacement may complete literal runs or add first symbols of other clauses
+        int scanStart = matchResult->offset - dispatch->longestAnchor + 1;
+        int scanEnd = matchResult->offset + replacementLength + dispatch->longestAnchor - 1;
+        int newLength = SEQUENCE_LENGTH(tokens);
+        Dispatch_scan(dispatch, tokens, scanStart < 0 ? 0 : scanStart, scanEnd > newLength ? newLength : scanEnd, context->candidates, context->presentTokens);
+
         DBG("New tokens:\n\t");
         for (int j=0; j<newLength; j++){
-            DBG("%s, ", substituted[j]);
+            DBG("%d, ", SEQUENCE_GET(tokens, j));
         }
         DBG("\n");
 
-
-        return Rule_execute(instance, substituted, newLength, metric, direction, substitutions, newNumberOfTokens, matchResult->offset + matchResult->length, 0);
+        if (timeClauses){
+            COUNTER_ADD(counters[i].nanoseconds, Stats_now() - start);
+        }
+        firstClause = 0;
+        Arena_rewind(context->arena, mark);
     }
-    
-    *newNumberOfTokens = numberOfTokens;
-    return result;
+
+    DBG("Reached end of tokens for this rule...\n");
+    return 0;
 }
 
+// free a Rule and its clauses
+int Rule_free(Rule* instance){
+    for (int i=0; i<instance->numberOfClauses; i++){
+        Clause_free(instance->clauses[i]);
+    }
+    free(instance->clauses);
+    free(instance->minimalMetric);
+    free(instance->maximalMetric);
+    free(instance);
+    return 0;
+}
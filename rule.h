@@ -6,9 +6,13 @@
 // initialize a new Rule
 Rule* Rule_init(char* ruleString);
 
-// Execute a rule
-char** Rule_execute(Rule* instance, char** tokens, int numberofTokens, int metric, int direction, int* substitutions, int* newNumberOfTokens, int startOffset, int startingClause);
+// Execute a rule on a Sequence of tokens in place (from startOffset and startingClause)
+// only clauses marked in the context's candidates are tried
+int Rule_execute(Rule* instance, Sequence* tokens, int metric, int direction, int* substitutions, int startOffset, int startingClause, Context* context);
 
 int Rule_cacheBestMetrics(Rule* instance);
 
+// free a Rule and its clauses
+int Rule_free(Rule* instance);
+
 #endif
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "sequence.h"
+
+#define SEQUENCE_MINIMUM_GAP 16
+
+///////////////////////////////////////////
+// Private Functions
+
+// move the gap so that it starts at offset
+int Sequence_moveGap(Sequence* instance, int offset){
+    if (offset < instance->gapStart){
+        // move the tokens between offset and the gap to after the gap
+        int count = instance->gapStart - offset;
+        memmove(instance->tokens + instance->gapEnd - count, instance->tokens + offset, sizeof(int) * count);
+        instance->gapStart -= count;
+        instance->gapEnd -= count;
+    } else if (offset > instance->gapStart){
+        // move the tokens between the gap and offset to before the gap
+        int count = offset - instance->gapStart;
+        memmove(instance->tokens + instance->gapStart, instance->tokens + instance->gapEnd, sizeof(int) * count);
+        instance->gapStart += count;
+        instance->gapEnd += count;
+    }
+    return 0;
+}
+
+// make the gap at least size tokens long
+int Sequence_growGap(Sequence* instance, int size){
+    int gapSize = instance->gapEnd - instance->gapStart;
+    if (gapSize >= size){
+        return 0;
+    }
+
+    int newCapacity = instance->capacity * 2;
+    if (newCapacity - (instance->capacity - gapSize) < size){
+        newCapacity = instance->capacity - gapSize + size;
+    }
+    if (newCapacity - (instance->capacity - gapSize) < SEQUENCE_MINIMUM_GAP){
+        newCapacity = instance->capacity - gapSize + SEQUENCE_MINIMUM_GAP;
+    }
+
+    int afterGap = instance->capacity - instance->gapEnd;
+    instance->tokens = realloc(instance->tokens, sizeof(int) * newCapacity);
+    memmove(instance->tokens + newCapacity - afterGap, instance->tokens + instance->gapEnd, sizeof(int) * afterGap);
+    instance->gapEnd = newCapacity - afterGap;
+    instance->capacity = newCapacity;
+
+    DBG("Sequence grown to %d tokens\n", newCapacity);
+    return 0;
+}
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new Sequence with a copy of an array of tokens
+// the tokens are kept in a gap buffer so that nearby substitutions only move the gap
+Sequence* Sequence_init(int* tokens, int numberOfTokens){
+    Sequence* result = (Sequence*) malloc(sizeof(Sequence));
+
+    result->capacity = numberOfTokens + SEQUENCE_MINIMUM_GAP;
+    result->tokens = (int*) malloc(sizeof(int) * result->capacity);
+    memcpy(result->tokens, tokens, sizeof(int) * numberOfTokens);
+    result->gapStart = numberOfTokens;
+    result->gapEnd = result->capacity;
+
+    return result;
+}
+
+// replace removeLength tokens at offset with an array of tokens
+int Sequence_splice(Sequence* instance, int offset, int removeLength, int* insert, int insertLength){
+    Sequence_moveGap(instance, offset);
+
+    // the removed tokens join the gap
+    instance->gapEnd += removeLength;
+
+    Sequence_growGap(instance, insertLength);
+    memcpy(instance->tokens + instance->gapStart, insert, sizeof(int) * insertLength);
+    instance->gapStart += insertLength;
+
+    return 0;
+}
+
+// copy every token into an array (of at least SEQUENCE_LENGTH tokens)
+int Sequence_copy(Sequence* instance, int* destination){
+    memcpy(destination, instance->tokens, sizeof(int) * instance->gapStart);
+    memcpy(destination + instance->gapStart, instance->tokens + instance->gapEnd, sizeof(int) * (instance->capacity - instance->gapEnd));
+    return 0;
+}
+
+// check if the tokens equal an array of SEQUENCE_LENGTH tokens
+int Sequence_equals(Sequence* instance, int* tokens){
+    return !memcmp(tokens, instance->tokens, sizeof(int) * instance->gapStart)
+        && !memcmp(tokens + instance->gapStart, instance->tokens + instance->gapEnd, sizeof(int) * (instance->capacity - instance->gapEnd));
+}
+
+// free a Sequence
+int Sequence_free(Sequence* instance){
+    free(instance->tokens);
+    free(instance);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include "structures.h"
+
+// get the token at an index of a Sequence
+#define SEQUENCE_GET(sequence, index) ((index) < (sequence)->gapStart ? (sequence)->tokens[(index)] : (sequence)->tokens[(index) + (sequence)->gapEnd - (sequence)->gapStart])
+
+// get the number of tokens in a Sequence
+#define SEQUENCE_LENGTH(sequence) ((sequence)->capacity - ((sequence)->gapEnd - (sequence)->gapStart))
+
+// initialize a new Sequence with a copy of an array of tokens
+Sequence* Sequence_init(int* tokens, int numberOfTokens);
+
+// replace removeLength tokens at offset with an array of tokens
+int Sequence_splice(Sequence* instance, int offset, int removeLength, int* insert, int insertLength);
+
+// copy every token into an array (of at least SEQUENCE_LENGTH tokens)
+int Sequence_copy(Sequence* instance, int* destination);
+
+// check if the tokens equal an array of SEQUENCE_LENGTH tokens
+int Sequence_equals(Sequence* instance, int* tokens);
+
+// free a Sequence
+int Sequence_free(Sequence* instance);
+
+#endif
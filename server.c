@@ -0,0 +1,598 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "context.h"
+#include "batch.h"
+#include "frame.h"
+#include "stats.h"
+#include "trace.h"
+#include "server.h"
+
+#define SERVER_BACKLOG 128
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE (64 * 1024)
+#define SERVER_MAX_LINE_LENGTH (1024 * 1024)
+
+// set by SIGINT and SIGTERM
+volatile sig_atomic_t serverStopRequested = 0;
+
+///////////////////////////////////////////
+// Private Functions
+
+void Server_handleSignal(int signal){
+    serverStopRequested = 1;
+}
+
+// answer the stats command with a dump ended by an empty line ("stats json": with a snapshot line)
+int Server_reportStats(Server* instance, ServerJob* job, int json){
+    if (instance->stats == NULL){
+        char* message = "error: this server keeps no stats\n";
+        OutputBuffer_append(&job->output, message, strlen(message));
+        return 1;
+    }
+    char* report = NULL;
+    size_t reportLength = 0;
+    FILE* fp = open_memstream(&report, &reportLength);
+    if (json){
+        Stats_writeSnapshot(instance->stats, fp);
+    } else {
+        Stats_report(instance->stats, fp);
+        fputc('\n', fp);
+    }
+    fclose(fp);
+    OutputBuffer_append(&job->output, report, reportLength);
+    free(report);
+    return 0;
+}
+
+// execute the tokens of a request with its substitutions traced
+// the result line is followed by the explanation and an empty line (the cache is bypassed so there is something to explain)
+int Server_explain(Context* context, char* tokens, size_t length, int metric, int direction, OutputBuffer* output){
+    Cache* cache = context->cache;
+    context->cache = NULL;
+    Context_setTracing(context, 1);
+    Batch_executeLine(context, tokens, length, metric, direction, output);
+    Context_setTracing(context, 0);
+    context->cache = cache;
+
+    char* explanation = NULL;
+    size_t explanationLength = 0;
+    FILE* fp = open_memstream(&explanation, &explanationLength);
+    Trace_explain(context->trace, context->engine, fp);
+    fputc('\n', fp);
+    fclose(fp);
+    OutputBuffer_append(output, explanation, explanationLength);
+    free(explanation);
+    return 0;
+}
+
+// read one "<name>=<positive integer> " limit at the start of *request into limits and move past it
+// returns 1 if one was read, 0 if *request does not start with a limit and -1 if it is malformed
+int Server_parseLimit(char** request, Limits* limits){
+    char* names[] = {"deadline-us=", "max-passes=", "max-substitutions="};
+    for (int i=0; i<3; i++){
+        size_t nameLength = strlen(names[i]);
+        if (strncmp(*request, names[i], nameLength) != 0){
+            continue;
+        }
+        char* valueStart = *request + nameLength;
+        char* end = NULL;
+        long value = strtol(valueStart, &end, 10);
+        if (end == valueStart || *end != ' ' || value < 1){
+            return -1;
+        }
+        switch (i){
+            case 0:
+                limits->nanoseconds = value * 1000;
+                break;
+            case 1:
+                limits->passes = (int) value;
+                break;
+            case 2:
+                limits->substitutions = value;
+                break;
+        }
+        *request = end + 1;
+        return 1;
+    }
+    return 0;
+}
+
+// execute one request: "[explain ][<limit>=<n> ...]<metric> <direction> <tokens...>\n", "stats\n" or "stats json\n"
+// the limits (deadline-us, max-passes, max-substitutions) replace the server's for this request only
+int Server_execute(Server* instance, Context* context, ServerJob* job){
+    char* request = job->request;
+    char* end = NULL;
+
+    if (job->requestLength >= 5 && strncmp(request, "stats", 5) == 0){
+        char* argument = request + 5;
+        if (job->requestLength == 5 || *argument == '\n'){
+            return Server_reportStats(instance, job, 0);
+        }
+        if (strncmp(argument, " json", 5) == 0 && (job->requestLength == 10 || argument[5] == '\n')){
+            return Server_reportStats(instance, job, 1);
+        }
+    }
+
+    int explain = job->requestLength >= 8 && strncmp(request, "explain ", 8) == 0;
+    if (explain){
+        request += 8;
+    }
+
+    Limits limits = context->limits;
+    int parsed;
+    while ((parsed = Server_parseLimit(&request, &limits)) == 1);
+    if (parsed < 0){
+        char* message = "error: a limit is deadline-us, max-passes or max-substitutions followed by = and a positive integer\n";
+        OutputBuffer_append(&job->output, message, strlen(message));
+        return 1;
+    }
+
+    long metric = strtol(request, &end, 10);
+    if (end == request || *end != ' ' || metric < 0){
+        char* message = "error: a request starts with a non-negative metric\n";
+        OutputBuffer_append(&job->output, message, strlen(message));
+        return 1;
+    }
+    char* directionStart = end + 1;
+    long direction = strtol(directionStart, &end, 10);
+    if (end == directionStart || (direction != -1 && direction != 1) || (*end != ' ' && *end != '\n')){
+        char* message = "error: the direction of a request must be either -1 or 1\n";
+        OutputBuffer_append(&job->output, message, strlen(message));
+        return 1;
+    }
+
+    // the tokens follow the direction (an empty line when there are none)
+    char* tokens = (*end == ' ') ? end + 1 : end;
+    size_t tokensLength = job->requestLength - (tokens - job->request);
+    Limits serverLimits = context->limits;
+    context->limits = limits;
+    if (explain){
+        Server_explain(context, tokens, tokensLength, metric, direction, &job->output);
+    } else {
+        Batch_executeLine(context, tokens, tokensLength, metric, direction, &job->output);
+    }
+    context->limits = serverLimits;
+    return 0;
+}
+
+// take jobs until the server stops
+void* Server_work(void* argument){
+    ServerWorker* worker = (ServerWorker*) argument;
+    Server* server = worker->server;
+
+    while (1){
+        pthread_mutex_lock(&server->lock);
+        while (server->queueHead == NULL && !server->stopping){
+            pthread_cond_wait(&server->jobQueued, &server->lock);
+        }
+        if (server->queueHead == NULL){
+            pthread_mutex_unlock(&server->lock);
+            return NULL;
+        }
+        ServerJob* job = server->queueHead;
+        server->queueHead = job->nextQueued;
+        if (server->queueHead == NULL){
+            server->queueTail = NULL;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (server->binary){
+            Frame_execute(worker->context, job->request, job->requestLength, &job->output);
+        } else {
+            Server_execute(server, worker->context, job);
+        }
+
+        pthread_mutex_lock(&server->lock);
+        job->nextQueued = server->finished;
+        server->finished = job;
+        pthread_mutex_unlock(&server->lock);
+
+        // wake the event loop
+        uint64_t one = 1;
+        if (write(server->wakeFd, &one, sizeof(uint64_t)) == -1){
+            DBG("Could not wake the event loop\n");
+        }
+    }
+}
+
+// close a connection and free a client
+int Server_closeClient(Server* instance, ServerClient* client){
+    DBG("Closing client %d\n", client->fd);
+    epoll_ctl(instance->epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client->input.bytes);
+    free(client->pending.bytes);
+    free(client);
+    return 0;
+}
+
+// write as much of a client's pending responses as the socket takes
+// returns 1 once the client was closed
+int Server_flushClient(Server* instance, ServerClient* client){
+    // move the responses that are done (in request order) to the pending bytes
+    // (only the event loop touches a job once a worker put it on the finished list)
+    while (client->firstJob != NULL && client->firstJob->done){
+        ServerJob* job = client->firstJob;
+        if (!client->failed){
+            OutputBuffer_append(&client->pending, job->output.bytes, job->output.length);
+        }
+        client->firstJob = job->nextInClient;
+        if (client->firstJob == NULL){
+            client->lastJob = NULL;
+        }
+        free(job->request);
+        free(job->output.bytes);
+        free(job);
+    }
+    int jobsLeft = client->firstJob != NULL;
+
+    while (!client->failed && client->pendingStart < client->pending.length){
+        ssize_t written = write(client->fd, client->pending.bytes + client->pendingStart, client->pending.length - client->pendingStart);
+        if (written == -1){
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                break;
+            }
+            client->failed = 1;
+            break;
+        }
+        client->pendingStart += written;
+    }
+    if (client->pendingStart == client->pending.length){
+        client->pending.length = 0;
+        client->pendingStart = 0;
+    }
+
+    // wait for the socket to take more only while something is left to write
+    int waitingToWrite = !client->failed && client->pending.length > 0;
+    if (!waitingToWrite && (client->failed || client->readClosed) && !jobsLeft){
+        Server_closeClient(instance, client);
+        return 1;
+    }
+    // a broken connection is only waiting for its jobs (which close it once done)
+    if (client->failed){
+        epoll_ctl(instance->epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+        return 0;
+    }
+    struct epoll_event event;
+    event.events = (client->readClosed ? 0 : EPOLLIN) | (waitingToWrite ? EPOLLOUT : 0);
+    event.data.ptr = client;
+    epoll_ctl(instance->epollFd, EPOLL_CTL_MOD, client->fd, &event);
+    return 0;
+}
+
+// queue one request of a client
+int Server_queueJob(Server* instance, ServerClient* client, char* request, size_t requestLength){
+    ServerJob* job = (ServerJob*) malloc(sizeof(ServerJob));
+    job->client = client;
+    job->requestLength = requestLength;
+    job->request = (char*) malloc(job->requestLength + 1);
+    memcpy(job->request, request, job->requestLength);
+    job->request[job->requestLength] = '\0';
+    job->output.bytes = NULL;
+    job->output.length = 0;
+    job->output.capacity = 0;
+    job->done = 0;
+    job->nextInClient = NULL;
+    job->nextQueued = NULL;
+
+    if (client->lastJob != NULL){
+        client->lastJob->nextInClient = job;
+    } else {
+        client->firstJob = job;
+    }
+    client->lastJob = job;
+
+    pthread_mutex_lock(&instance->lock);
+    if (instance->queueTail != NULL){
+        instance->queueTail->nextQueued = job;
+    } else {
+        instance->queueHead = job;
+    }
+    instance->queueTail = job;
+    pthread_cond_signal(&instance->jobQueued);
+    pthread_mutex_unlock(&instance->lock);
+    return 0;
+}
+
+// answer a client with an error after its earlier requests and stop reading from it
+// (the connection is closed once the responses are written)
+int Server_rejectClient(Server* instance, ServerClient* client, char* message){
+    ServerJob* job = (ServerJob*) calloc(1, sizeof(ServerJob));
+    job->client = client;
+    OutputBuffer_append(&job->output, message, strlen(message));
+    job->done = 1;
+
+    if (client->lastJob != NULL){
+        client->lastJob->nextInClient = job;
+    } else {
+        client->firstJob = job;
+    }
+    client->lastJob = job;
+
+    client->readClosed = 1;
+    client->input.length = 0;
+    return 0;
+}
+
+// queue every whole request a client sent
+int Server_queueRequests(Server* instance, ServerClient* client){
+    size_t requestStart = 0;
+    if (instance->binary){
+        // one job per frame
+        while (1){
+            long frameSize = Frame_size(client->input.bytes + requestStart, client->input.length - requestStart);
+            if (frameSize == -1){
+                // the stream cannot be followed anymore
+                client->failed = 1;
+                client->readClosed = 1;
+                break;
+            }
+            if (frameSize == 0){
+                break;
+            }
+            Server_queueJob(instance, client, client->input.bytes + requestStart, frameSize);
+            requestStart += frameSize;
+        }
+    } else {
+        for (size_t i=0; i<client->input.length; i++){
+            // a line may not grow the input without bound
+            if (i - requestStart >= SERVER_MAX_LINE_LENGTH){
+                Server_rejectClient(instance, client, "error: a request line is longer than the server accepts\n");
+                return 0;
+            }
+            if (client->input.bytes[i] == '\n'){
+                Server_queueJob(instance, client, client->input.bytes + requestStart, i + 1 - requestStart);
+                requestStart = i + 1;
+            }
+        }
+    }
+
+    // keep the start of an unfinished request
+    memmove(client->input.bytes, client->input.bytes + requestStart, client->input.length - requestStart);
+    client->input.length -= requestStart;
+    return 0;
+}
+
+// read everything a client sent
+int Server_readClient(Server* instance, ServerClient* client){
+    char buffer[SERVER_READ_SIZE];
+    while (1){
+        ssize_t bytesRead = read(client->fd, buffer, SERVER_READ_SIZE);
+        if (bytesRead == -1){
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                break;
+            }
+            client->readClosed = 1;
+            client->failed = 1;
+            break;
+        }
+        if (bytesRead == 0){
+            client->readClosed = 1;
+            break;
+        }
+        OutputBuffer_append(&client->input, buffer, bytesRead);
+        // queue the whole lines before reading a line that is too long any further
+        if (!instance->binary && client->input.length > SERVER_MAX_LINE_LENGTH){
+            break;
+        }
+    }
+    Server_queueRequests(instance, client);
+    return Server_flushClient(instance, client);
+}
+
+// accept every waiting connection
+int Server_accept(Server* instance){
+    while (1){
+        int fd = accept4(instance->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1){
+            return 0;
+        }
+        ServerClient* client = (ServerClient*) calloc(1, sizeof(ServerClient));
+        client->fd = fd;
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        epoll_ctl(instance->epollFd, EPOLL_CTL_ADD, fd, &event);
+        DBG("Accepted client %d\n", fd);
+    }
+}
+
+// write the responses of the jobs the workers finished
+int Server_collectFinished(Server* instance){
+    uint64_t count;
+    if (read(instance->wakeFd, &count, sizeof(uint64_t)) == -1){
+        DBG("Nothing to collect\n");
+    }
+
+    pthread_mutex_lock(&instance->lock);
+    ServerJob* finished = instance->finished;
+    instance->finished = NULL;
+    pthread_mutex_unlock(&instance->lock);
+
+    // flushing frees the jobs that are done, so gather their clients first
+    // (a job is only marked done here, so it never leaves its client while still on the finished list)
+    int numberOfClients = 0;
+    int capacity = 16;
+    ServerClient** clients = (ServerClient**) malloc(sizeof(ServerClient*) * capacity);
+    for (ServerJob* job=finished; job != NULL; job = job->nextQueued){
+        job->done = 1;
+        int seen = 0;
+        for (int i=0; i<numberOfClients; i++){
+            if (clients[i] == job->client){
+                seen = 1;
+                break;
+            }
+        }
+        if (!seen){
+            if (numberOfClients == capacity){
+                capacity *= 2;
+                clients = (ServerClient**) realloc(clients, sizeof(ServerClient*) * capacity);
+            }
+            clients[numberOfClients] = job->client;
+            numberOfClients++;
+        }
+    }
+    for (int i=0; i<numberOfClients; i++){
+        Server_flushClient(instance, clients[i]);
+    }
+    free(clients);
+    return 0;
+}
+
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new Server listening on a Unix socket at path with numberOfWorkers workers that share one Engine
+// binary = requests are frames (see frame.h) instead of lines
+// cache = results shared by every worker (NULL = none)
+// stats = gets the counters of every worker and answers the stats command (NULL = none)
+Server* Server_init(Engine* engine, char* path, int numberOfWorkers, int binary, Cache* cache, Stats* stats){
+    Server* result = (Server*) malloc(sizeof(Server));
+    result->engine = engine;
+    result->binary = binary;
+    result->cache = cache;
+    result->stats = stats;
+    result->path = path;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)){
+        PANIC("Socket path is too long: %s\n", path);
+    }
+    strcpy(address.sun_path, path);
+
+    result->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (result->listenFd == -1){
+        PANIC("Could not create a socket\n");
+    }
+    // a socket left behind by an earlier server is replaced
+    unlink(path);
+    if (bind(result->listenFd, (struct sockaddr*) &address, sizeof(address)) || listen(result->listenFd, SERVER_BACKLOG)){
+        PANIC("Could not listen on %s\n", path);
+    }
+
+    result->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    result->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (result->epollFd == -1 || result->wakeFd == -1){
+        PANIC("Could not create the event loop\n");
+    }
+    // the listening socket and the eventfd are told apart from clients by their pointers
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &result->listenFd;
+    epoll_ctl(result->epollFd, EPOLL_CTL_ADD, result->listenFd, &event);
+    event.data.ptr = &result->wakeFd;
+    epoll_ctl(result->epollFd, EPOLL_CTL_ADD, result->wakeFd, &event);
+
+    pthread_mutex_init(&result->lock, NULL);
+    pthread_cond_init(&result->jobQueued, NULL);
+    result->queueHead = NULL;
+    result->queueTail = NULL;
+    result->finished = NULL;
+    result->stopping = 0;
+
+    result->numberOfWorkers = numberOfWorkers;
+    result->workers = (ServerWorker*) malloc(sizeof(ServerWorker) * numberOfWorkers);
+    for (int i=0; i<numberOfWorkers; i++){
+        result->workers[i].server = result;
+        result->workers[i].context = Context_init(engine);
+        result->workers[i].context->cache = cache;
+        if (stats != NULL){
+            Stats_addContext(stats, result->workers[i].context);
+        }
+        if (pthread_create(&result->workers[i].thread, NULL, Server_work, &result->workers[i])){
+            PANIC("Could not start worker thread %d\n", i);
+        }
+    }
+
+    return result;
+}
+
+// answer requests until SIGINT or SIGTERM (the workers finish the queued requests before it returns)
+// every request is a line "<metric> <direction> <token1> ... <tokenN>" and is answered with the result line
+int Server_run(Server* instance){
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = Server_handleSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    // a client that hangs up early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!serverStopRequested){
+        int numberOfEvents = epoll_wait(instance->epollFd, events, SERVER_MAX_EVENTS, -1);
+        if (numberOfEvents == -1){
+            if (errno == EINTR){
+                continue;
+            }
+            PANIC("Event loop failed\n");
+        }
+
+        for (int i=0; i<numberOfEvents; i++){
+            void* source = events[i].data.ptr;
+            if (source == &instance->listenFd){
+                Server_accept(instance);
+            } else if (source == &instance->wakeFd){
+                Server_collectFinished(instance);
+            } else {
+                ServerClient* client = (ServerClient*) source;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+                    // a hung up client can still have requests to read but takes no responses
+                    if (events[i].events & (EPOLLHUP | EPOLLERR)){
+                        client->failed = 1;
+                    }
+                    Server_readClient(instance, client);
+                } else if (events[i].events & EPOLLOUT){
+                    Server_flushClient(instance, client);
+                }
+            }
+        }
+    }
+
+    DBG("Server stopping\n");
+    pthread_mutex_lock(&instance->lock);
+    instance->stopping = 1;
+    pthread_cond_broadcast(&instance->jobQueued);
+    pthread_mutex_unlock(&instance->lock);
+
+    // the workers finish the jobs already queued
+    for (int i=0; i<instance->numberOfWorkers; i++){
+        pthread_join(instance->workers[i].thread, NULL);
+    }
+    return 0;
+}
+
+// remove the socket and free a Server (once Server_run returned)
+int Server_free(Server* instance){
+    for (int i=0; i<instance->numberOfWorkers; i++){
+        Context_free(instance->workers[i].context);
+    }
+    free(instance->workers);
+
+    close(instance->listenFd);
+    close(instance->epollFd);
+    close(instance->wakeFd);
+    unlink(instance->path);
+
+    pthread_mutex_destroy(&instance->lock);
+    pthread_cond_destroy(&instance->jobQueued);
+    free(instance);
+    return 0;
+}
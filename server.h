@@ -0,0 +1,23 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "structures.h"
+
+// initialize a new Server listening on a Unix socket at path with numberOfWorkers workers that share one Engine
+// binary = requests are frames (see frame.h) instead of lines
+// cache = results shared by every worker (NULL = none)
+// stats = gets the counters of every worker and answers the stats command (NULL = none)
+Server* Server_init(Engine* engine, char* path, int numberOfWorkers, int binary, Cache* cache, Stats* stats);
+
+// answer requests until SIGINT or SIGTERM (the workers finish the queued requests before it returns)
+// every request is a line "<metric> <direction> <token1> ... <tokenN>" and is answered with the result line
+// (a line longer than the server accepts is answered with an error and closes the connection)
+// (or a frame of requests answered with a frame of results when binary)
+// "explain <metric> <direction> <tokens...>" is answered with the result line, its substitutions and an empty line
+// a line "stats" is answered with a stats dump ended by an empty line, "stats json" with a JSON snapshot line
+int Server_run(Server* instance);
+
+// remove the socket and free a Server (once Server_run returned)
+int Server_free(Server* instance);
+
+#endif
@@ -0,0 +1,387 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "clause.h"
+#include "histogram.h"
+#include "profile.h"
+#include "stats.h"
+
+///////////////////////////////////////////
+// Private Functions
+
+// the counters of one clause added up over every Context
+int Stats_sumClause(Stats* instance, int clause, ClauseCounters* sum){
+    memset(sum, 0, sizeof(ClauseCounters));
+    for (int i=0; i<instance->numberOfContexts; i++){
+        ClauseCounters* counters = &instance->contexts[i]->clauseCounters[clause];
+        sum->attempts += COUNTER_GET(counters->attempts);
+        sum->offsets += COUNTER_GET(counters->offsets);
+        sum->steps += COUNTER_GET(counters->steps);
+        sum->matches += COUNTER_GET(counters->matches);
+        sum->substitutions += COUNTER_GET(counters->substitutions);
+        sum->substitutionPasses += COUNTER_GET(counters->substitutionPasses);
+        sum->nanoseconds += COUNTER_GET(counters->nanoseconds);
+    }
+    return 0;
+}
+
+int Stats_addCounters(ClauseCounters* sum, ClauseCounters* counters){
+    sum->attempts += counters->attempts;
+    sum->offsets += counters->offsets;
+    sum->steps += counters->steps;
+    sum->matches += counters->matches;
+    sum->substitutions += counters->substitutions;
+    sum->substitutionPasses += counters->substitutionPasses;
+    sum->nanoseconds += counters->nanoseconds;
+    return 0;
+}
+
+int Stats_printCounters(ClauseCounters* counters, FILE* fp){
+    fprintf(fp, "%ld attempts, %ld offsets, %ld steps, %ld matches, %ld substitutions", counters->attempts, counters->offsets, counters->steps, counters->matches, counters->substitutions);
+    if (counters->nanoseconds > 0){
+        fprintf(fp, ", %.3f ms", counters->nanoseconds / 1e6);
+    }
+    fprintf(fp, "\n");
+    return 0;
+}
+
+// rules are ranked by time when it was measured, otherwise by automaton steps
+int compareRuleTotals(const void* a, const void* b){
+    ClauseCounters* first = &((RuleTotals*) a)->counters;
+    ClauseCounters* second = &((RuleTotals*) b)->counters;
+    long firstCost = first->nanoseconds > 0 ? first->nanoseconds : first->steps;
+    long secondCost = second->nanoseconds > 0 ? second->nanoseconds : second->steps;
+    if (firstCost != secondCost){
+        return firstCost < secondCost ? 1 : -1;
+    }
+    return ((RuleTotals*) a)->rule - ((RuleTotals*) b)->rule;
+}
+
+// rules ranked by the cycles they were part of
+int compareRuleCycles(const void* a, const void* b){
+    long first = ((RuleTotals*) a)->cycles;
+    long second = ((RuleTotals*) b)->cycles;
+    if (first != second){
+        return first < second ? 1 : -1;
+    }
+    return ((RuleTotals*) a)->rule - ((RuleTotals*) b)->rule;
+}
+
+// the request histograms of every Context added up
+int Stats_mergeHistograms(Stats* instance, RequestHistograms* sum){
+    memset(sum, 0, sizeof(RequestHistograms));
+    for (int i=0; i<instance->numberOfContexts; i++){
+        RequestHistograms* histograms = instance->contexts[i]->histograms;
+        Histogram_merge(&sum->nanoseconds, &histograms->nanoseconds);
+        Histogram_merge(&sum->passes, &histograms->passes);
+        Histogram_merge(&sum->substitutions, &histograms->substitutions);
+        Histogram_merge(&sum->inputTokens, &histograms->inputTokens);
+        Histogram_merge(&sum->outputTokens, &histograms->outputTokens);
+    }
+    return 0;
+}
+
+// dump on every SIGUSR1 and rewrite the snapshot file every interval until the Stats is freed
+void* Stats_waitForSignal(void* argument){
+    Stats* instance = (Stats*) argument;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    struct timespec interval = {instance->snapshotInterval, 0};
+
+    while (1){
+        int signal;
+        if (instance->snapshotPath != NULL){
+            signal = sigtimedwait(&signals, NULL, &interval);
+        } else {
+            sigwait(&signals, &signal);
+        }
+        if (__atomic_load_n(&instance->stopping, __ATOMIC_ACQUIRE)){
+            return NULL;
+        }
+        if (signal == SIGUSR1){
+            Stats_report(instance, instance->signalOutput);
+            fflush(instance->signalOutput);
+        } else {
+            Stats_writeSnapshotFile(instance);
+        }
+    }
+}
+
+
+///////////////////////////////////////////
+// Public Functions
+
+// nanoseconds on the monotonic clock
+long Stats_now(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// block SIGUSR1 in this thread and every thread it starts afterwards (so only the signal thread takes it)
+int Stats_blockSignal(){
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    return 0;
+}
+
+// initialize a new Stats for the Contexts of an Engine
+Stats* Stats_init(Engine* engine){
+    Stats* result = (Stats*) malloc(sizeof(Stats));
+    result->engine = engine;
+    pthread_mutex_init(&result->lock, NULL);
+    result->numberOfContexts = 0;
+    result->contextCapacity = 0;
+    result->contexts = NULL;
+    result->signalOutput = NULL;
+    result->snapshotPath = NULL;
+    result->snapshotInterval = 0;
+    result->listening = 0;
+    result->stopping = 0;
+    return result;
+}
+
+// include the counters of a Context in every dump
+int Stats_addContext(Stats* instance, Context* context){
+    pthread_mutex_lock(&instance->lock);
+    if (instance->numberOfContexts == instance->contextCapacity){
+        instance->contextCapacity = instance->contextCapacity ? instance->contextCapacity * 2 : 8;
+        instance->contexts = (Context**) realloc(instance->contexts, sizeof(Context*) * instance->contextCapacity);
+    }
+    instance->contexts[instance->numberOfContexts] = context;
+    instance->numberOfContexts++;
+    pthread_mutex_unlock(&instance->lock);
+    return 0;
+}
+
+// print the totals, the totals of each thread, the request histograms and the costliest rules with their clauses
+int Stats_report(Stats* instance, FILE* fp){
+    pthread_mutex_lock(&instance->lock);
+    Engine* engine = instance->engine;
+    int numberOfClauses = engine->dispatch->numberOfClauses;
+
+    // totals (the first line keeps the format of --stats)
+    long executions = 0;
+    long passes = 0;
+    long substitutions = 0;
+    long cycles = 0;
+    long partials = 0;
+    for (int i=0; i<instance->numberOfContexts; i++){
+        executions += COUNTER_GET(instance->contexts[i]->numberOfExecutions);
+        passes += COUNTER_GET(instance->contexts[i]->numberOfPasses);
+        substitutions += COUNTER_GET(instance->contexts[i]->numberOfSubstitutions);
+        cycles += COUNTER_GET(instance->contexts[i]->numberOfCycles);
+        partials += COUNTER_GET(instance->contexts[i]->numberOfPartials);
+    }
+    fprintf(fp, "stats: %ld executions, %ld passes, %ld substitutions, %ld cycles, %ld partial\n", executions, passes, substitutions, cycles, partials);
+
+    // each thread on its own
+    if (instance->numberOfContexts > 1){
+        for (int i=0; i<instance->numberOfContexts; i++){
+            Context* context = instance->contexts[i];
+            ClauseCounters sum;
+            memset(&sum, 0, sizeof(ClauseCounters));
+            for (int j=0; j<numberOfClauses; j++){
+                ClauseCounters counters;
+                counters.attempts = COUNTER_GET(context->clauseCounters[j].attempts);
+                counters.offsets = COUNTER_GET(context->clauseCounters[j].offsets);
+                counters.steps = COUNTER_GET(context->clauseCounters[j].steps);
+                counters.matches = COUNTER_GET(context->clauseCounters[j].matches);
+                counters.substitutions = COUNTER_GET(context->clauseCounters[j].substitutions);
+                counters.substitutionPasses = COUNTER_GET(context->clauseCounters[j].substitutionPasses);
+                counters.nanoseconds = COUNTER_GET(context->clauseCounters[j].nanoseconds);
+                Stats_addCounters(&sum, &counters);
+            }
+            fprintf(fp, "thread %d: %ld executions, ", i, COUNTER_GET(context->numberOfExecutions));
+            Stats_printCounters(&sum, fp);
+        }
+    }
+
+    // distributions over the requests
+    RequestHistograms histograms;
+    Stats_mergeHistograms(instance, &histograms);
+    Histogram_print(&histograms.nanoseconds, "latency_ns", fp);
+    Histogram_print(&histograms.passes, "passes", fp);
+    Histogram_print(&histograms.substitutions, "substitutions", fp);
+    Histogram_print(&histograms.inputTokens, "input_tokens", fp);
+    Histogram_print(&histograms.outputTokens, "output_tokens", fp);
+
+    // rules by cost
+    RuleTotals* totals = (RuleTotals*) malloc(sizeof(RuleTotals) * (engine->numberOfCompiledRules + 1));
+    int numberOfUsedRules = 0;
+    for (int i=0; i<engine->numberOfCompiledRules; i++){
+        Rule* rule = engine->compiledRules[i];
+        RuleTotals* ruleTotals = &totals[numberOfUsedRules];
+        ruleTotals->rule = i;
+        memset(&ruleTotals->counters, 0, sizeof(ClauseCounters));
+        ruleTotals->cycles = 0;
+        for (int j=0; j<instance->numberOfContexts; j++){
+            ruleTotals->cycles += COUNTER_GET(instance->contexts[j]->ruleCycles[i]);
+        }
+        for (int j=0; j<rule->numberOfClauses; j++){
+            ClauseCounters sum;
+            Stats_sumClause(instance, rule->firstClause + j, &sum);
+            Stats_addCounters(&ruleTotals->counters, &sum);
+        }
+        if (ruleTotals->counters.attempts > 0){
+            numberOfUsedRules++;
+        }
+    }
+    qsort(totals, numberOfUsedRules, sizeof(RuleTotals), compareRuleTotals);
+
+    int shown = numberOfUsedRules < STATS_TOP_RULES ? numberOfUsedRules : STATS_TOP_RULES;
+    fprintf(fp, "rules by %s (%d of %d that were tried):\n", engine->timeClauses ? "time" : "steps", shown, numberOfUsedRules);
+    for (int i=0; i<shown; i++){
+        Rule* rule = engine->compiledRules[totals[i].rule];
+        fprintf(fp, "  rule %d: ", rule->number);
+        Stats_printCounters(&totals[i].counters, fp);
+
+        for (int j=0; j<rule->numberOfClauses; j++){
+            Clause* clause = rule->clauses[j];
+            fprintf(fp, "    clause %d \"", j);
+            Clause_print(clause, engine->symbols, fp);
+            fprintf(fp, "\": ");
+            ClauseCounters sum;
+            Stats_sumClause(instance, rule->firstClause + j, &sum);
+            Stats_printCounters(&sum, fp);
+        }
+    }
+
+    // the rules that kept undoing each other
+    if (cycles > 0){
+        qsort(totals, numberOfUsedRules, sizeof(RuleTotals), compareRuleCycles);
+        fprintf(fp, "rules in cycles:\n");
+        for (int i=0; i<numberOfUsedRules && i<STATS_TOP_RULES && totals[i].cycles > 0; i++){
+            fprintf(fp, "  rule %d: %ld cycles\n", engine->compiledRules[totals[i].rule]->number, totals[i].cycles);
+        }
+    }
+
+    free(totals);
+    pthread_mutex_unlock(&instance->lock);
+    return 0;
+}
+
+// write the totals and the request histograms as one line of JSON
+int Stats_writeSnapshot(Stats* instance, FILE* fp){
+    pthread_mutex_lock(&instance->lock);
+    long executions = 0;
+    long passes = 0;
+    long substitutions = 0;
+    long cycles = 0;
+    long partials = 0;
+    for (int i=0; i<instance->numberOfContexts; i++){
+        executions += COUNTER_GET(instance->contexts[i]->numberOfExecutions);
+        passes += COUNTER_GET(instance->contexts[i]->numberOfPasses);
+        substitutions += COUNTER_GET(instance->contexts[i]->numberOfSubstitutions);
+        cycles += COUNTER_GET(instance->contexts[i]->numberOfCycles);
+        partials += COUNTER_GET(instance->contexts[i]->numberOfPartials);
+    }
+    RequestHistograms histograms;
+    Stats_mergeHistograms(instance, &histograms);
+    pthread_mutex_unlock(&instance->lock);
+
+    fprintf(fp, "{\"time\": %ld, \"executions\": %ld, \"passes\": %ld, \"substitutions\": %ld, \"cycles\": %ld, \"partial\": %ld", (long) time(NULL), executions, passes, substitutions, cycles, partials);
+    fprintf(fp, ", \"latency_ns\": ");
+    Histogram_writeJson(&histograms.nanoseconds, fp);
+    fprintf(fp, ", \"passes_per_request\": ");
+    Histogram_writeJson(&histograms.passes, fp);
+    fprintf(fp, ", \"substitutions_per_request\": ");
+    Histogram_writeJson(&histograms.substitutions, fp);
+    fprintf(fp, ", \"input_tokens\": ");
+    Histogram_writeJson(&histograms.inputTokens, fp);
+    fprintf(fp, ", \"output_tokens\": ");
+    Histogram_writeJson(&histograms.outputTokens, fp);
+    fprintf(fp, "}\n");
+    return 0;
+}
+
+// replace the snapshot file with a new snapshot (written next to it, then renamed so readers never see half of one)
+int Stats_writeSnapshotFile(Stats* instance){
+    size_t pathLength = strlen(instance->snapshotPath);
+    char* temporaryPath = (char*) malloc(pathLength + 5);
+    memcpy(temporaryPath, instance->snapshotPath, pathLength);
+    strcpy(temporaryPath + pathLength, ".tmp");
+
+    FILE* fp = fopen(temporaryPath, "w");
+    if (fp == NULL){
+        DBG("Could not write the stats snapshot %s\n", temporaryPath);
+        free(temporaryPath);
+        return 1;
+    }
+    Stats_writeSnapshot(instance, fp);
+    fclose(fp);
+    rename(temporaryPath, instance->snapshotPath);
+    free(temporaryPath);
+    return 0;
+}
+
+// write the counters of every rule in database order to a profile file (for Engine_orderRules)
+int Stats_writeProfile(Stats* instance, char* path){
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL){
+        return 1;
+    }
+    Engine* engine = instance->engine;
+
+    // the compiled order may differ from the database order
+    Rule** rules = (Rule**) malloc(sizeof(Rule*) * (engine->numberOfCompiledRules + 1));
+    for (int i=0; i<engine->numberOfCompiledRules; i++){
+        rules[engine->compiledRules[i]->number] = engine->compiledRules[i];
+    }
+
+    pthread_mutex_lock(&instance->lock);
+    fprintf(fp, "%s %d %d\n", PROFILE_MAGIC, PROFILE_VERSION, engine->numberOfCompiledRules);
+    for (int i=0; i<engine->numberOfCompiledRules; i++){
+        ClauseCounters totals;
+        memset(&totals, 0, sizeof(ClauseCounters));
+        for (int j=0; j<rules[i]->numberOfClauses; j++){
+            ClauseCounters sum;
+            Stats_sumClause(instance, rules[i]->firstClause + j, &sum);
+            Stats_addCounters(&totals, &sum);
+        }
+        fprintf(fp, "%d %d %ld %ld %ld %ld %ld\n", i, rules[i]->numberOfClauses, totals.attempts, totals.steps, totals.matches, totals.substitutions, totals.substitutionPasses);
+    }
+    pthread_mutex_unlock(&instance->lock);
+
+    free(rules);
+    fclose(fp);
+    return 0;
+}
+
+// rewrite a JSON snapshot at path every interval seconds once listening (call before Stats_listen)
+int Stats_snapshotEvery(Stats* instance, char* path, int interval){
+    instance->snapshotPath = path;
+    instance->snapshotInterval = interval;
+    return 0;
+}
+
+// dump to fp every time the process gets SIGUSR1 (call Stats_blockSignal before starting any thread)
+int Stats_listen(Stats* instance, FILE* fp){
+    instance->signalOutput = fp;
+    if (pthread_create(&instance->signalThread, NULL, Stats_waitForSignal, instance)){
+        PANIC("Could not start the stats thread\n");
+    }
+    instance->listening = 1;
+    return 0;
+}
+
+// stop listening and free a Stats (the Contexts are not freed)
+int Stats_free(Stats* instance){
+    if (instance->listening){
+        __atomic_store_n(&instance->stopping, 1, __ATOMIC_RELEASE);
+        pthread_kill(instance->signalThread, SIGUSR1);
+        pthread_join(instance->signalThread, NULL);
+    }
+    pthread_mutex_destroy(&instance->lock);
+    free(instance->contexts);
+    free(instance);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+#include "structures.h"
+
+// rules listed by a dump
+#define STATS_TOP_RULES 20
+
+// add to a counter only its own thread writes while other threads may read it
+#define COUNTER_ADD(counter, amount) __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (amount), __ATOMIC_RELAXED)
+
+// read a counter another thread may be writing
+#define COUNTER_GET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+// nanoseconds on the monotonic clock
+long Stats_now();
+
+// block SIGUSR1 in this thread and every thread it starts afterwards (so only the signal thread takes it)
+int Stats_blockSignal();
+
+// initialize a new Stats for the Contexts of an Engine
+Stats* Stats_init(Engine* engine);
+
+// include the counters of a Context in every dump
+int Stats_addContext(Stats* instance, Context* context);
+
+// print the totals, the totals of each thread, the request histograms and the costliest rules with their clauses
+int Stats_report(Stats* instance, FILE* fp);
+
+// write the totals and the request histograms as one line of JSON
+int Stats_writeSnapshot(Stats* instance, FILE* fp);
+
+// replace the snapshot file with a new snapshot (written next to it, then renamed so readers never see half of one)
+int Stats_writeSnapshotFile(Stats* instance);
+
+// write the counters of every rule in database order to a profile file (for Engine_orderRules)
+int Stats_writeProfile(Stats* instance, char* path);
+
+// rewrite a JSON snapshot at path every interval seconds once listening (call before Stats_listen)
+int Stats_snapshotEvery(Stats* instance, char* path, int interval);
+
+// dump to fp every time the process gets SIGUSR1 (call Stats_blockSignal before starting any thread)
+int Stats_listen(Stats* instance, FILE* fp);
+
+// stop listening and free a Stats (the Contexts are not freed)
+int Stats_free(Stats* instance);
+
+#endif
@@ -1,6 +1,11 @@
 #ifndef STRUCTURES_H
 #define STRUCTURES_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
 typedef struct MatchResult{
     int offset;
     int length;
@@ -8,9 +13,88 @@ typedef struct MatchResult{
     // TODO: handle variable bindings
     int numberOfVariables;
     int* variableBindingLengths; // number of Variables length
-    char*** variableBindings; // number of Variables length of variableBindings length
+    int** variableBindings; // number of Variables length of variableBindings length
 } MatchResult;
 
+// Counters of one compiled clause in one Context
+// (only the Context's thread writes them, with COUNTER_ADD so a stats dump can read them at any time)
+typedef struct ClauseCounters{
+    long attempts; // calls to Clause_match
+    long offsets; // offsets a match was started at
+    long steps; // threads the automaton advanced
+    long matches;
+    long substitutions; // times a match of the clause was replaced by the rule's best clause
+    long substitutionPasses; // the passes those substitutions were made on added up
+    long nanoseconds; // time spent matching and substituting (only with Engine->timeClauses)
+} ClauseCounters;
+
+// The counters of every clause of one rule added up (for sorting rules by cost)
+typedef struct RuleTotals{
+    int rule;
+    ClauseCounters counters;
+    long cycles; // rewrites stopped by a cycle the rule made substitutions in
+} RuleTotals;
+
+// values below 16 get a bucket each, then every power of two is split into 8 buckets (up to 2^63)
+#define HISTOGRAM_BUCKETS (16 + 59 * 8)
+
+// A Histogram counts values in log-linear buckets, so a percentile read from it is within 12.5%
+// (only one thread records into it, with COUNTER_ADD so a snapshot can read it at any time)
+typedef struct Histogram{
+    long count;
+    long sum;
+    long maximum;
+    long buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+// The distributions over the requests a Context executed
+typedef struct RequestHistograms{
+    Histogram nanoseconds; // time in Engine_execute
+    Histogram passes; // rewrite passes (over every bracket segment and the whole input)
+    Histogram substitutions;
+    Histogram inputTokens;
+    Histogram outputTokens;
+} RequestHistograms;
+
+// A Sequence holds an array of tokens in a gap buffer
+// so a substitution only moves the gap instead of copying the whole array
+typedef struct Sequence{
+    int* tokens; // tokens before the gap, the gap, then tokens after the gap
+    int capacity;
+    int gapStart;
+    int gapEnd;
+} Sequence;
+
+// An Arena hands out memory from large blocks and frees all of it at once
+typedef struct Arena{
+    size_t blockSize; // minimum size of each block
+    int numberOfBlocks;
+    int capacity;
+    char** blocks;
+    size_t* blockSizes;
+
+    int currentBlock; // block allocations are currently taken from (-1 = none yet)
+    size_t used; // bytes used in the current block
+} Arena;
+
+// An ArenaMark remembers how much of an Arena was in use
+typedef struct ArenaMark{
+    int block;
+    size_t used;
+} ArenaMark;
+
+// A SymbolTable interns token strings into integer ids
+typedef struct SymbolTable{
+    int numberOfSymbols;
+    int capacity;
+    char** symbols; // symbol id -> string
+    size_t* lengths; // symbol id -> length in bytes (a token of a binary frame may contain NULs)
+    Arena* strings; // copies of the symbols (NULL when they live in a compiled image)
+
+    int numberOfBuckets; // always a power of 2
+    int* buckets; // open addressing hash table of symbol ids (-1 = empty)
+} SymbolTable;
+
 typedef struct Matcher{
     int* minRepetitions; // minimum number of repetitions for token at this index
     int* maxRepetitions; // maximum number of repetitions for token at this index
@@ -18,13 +102,39 @@ typedef struct Matcher{
     int* internalVariables; // which variables are internal (-1 = not)
 
     int* numberOfMatchingTokens; // 0 = Any, otherwise the lengths of matchingTokens
-    char*** matchingTokens; // NULL = Any, otherwise is an array of strings that match
+    int** matchingTokens; // NULL = Any, otherwise is an array of symbol ids that match
+
+    // The clause compiled into an automaton whose states are (token index, repetitions so far).
+    // Repetitions past the minimum of an unbounded token share one state.
+    int numberOfTokens;
+    int numberOfStates;
+    int* stateBase; // first state of each token index (numberOfTokens+1 length, the last is the match state)
+    int* stateTokens; // token index of each state
+    int* stateRepetitions; // repetitions so far of each state
+
+    int numberOfVariables; // highest variable accessed + 1
+    int captureSize; // offsets each thread tracks (1 when no variables are bound, otherwise numberOfTokens+1)
+
+    // FIRST set: the symbols a match can start with
+    int firstAny; // 1 if a match can start with any token (or be empty)
+    int numberOfFirstTokens;
+    int* firstTokens;
 } Matcher;
 
+// A ThreadList holds the running threads of a Matcher's automaton in priority order
+typedef struct ThreadList{
+    int numberOfThreads;
+    int* states; // automaton state of each thread
+    int* captures; // captureSize offsets per thread (where each token's repetitions started)
+} ThreadList;
+
 // A Clause holds an array of Tokens and their metrics
 typedef struct Clause{
     int numberOfTokens;
-    char** tokens; 
+    char** tokenStrings; // raw token strings (freed once the matcher is created)
+    int numberOfSymbolStrings;
+    char** symbolStrings; // decoded symbols waiting to be interned (each token's alternatives, the token, then NULL)
+    int* tokens; // symbol ids of the tokens once the matcher is created
 
     int numberOfMetrics;
     float* metrics; // metric value of -1 is equivalent to empty
@@ -41,23 +151,539 @@ typedef struct Rule{
     int numberOfMetrics;
     int* minimalMetric; // for each metric, the clause index of the minimal representation
     int* maximalMetric; // for each metric, the clause index of the maximal representation
+
+    int firstClause; // index of this rule's first clause among every compiled clause
+    int number; // position of the rule in the databases (the compiled order may differ, see Engine_orderRules)
 } Rule;
 
+// The counters of one rule in a profile written by an earlier run
+typedef struct RuleProfile{
+    int numberOfClauses; // to tell whether the profile is of the same databases
+    long attempts;
+    long steps;
+    long matches;
+    long substitutions;
+    long substitutionPasses; // divided by substitutions = the mean pass the rule made them on
+} RuleProfile;
+
+// A Profile has the counters of every rule of the databases (in database order)
+typedef struct Profile{
+    int numberOfRules;
+    RuleProfile* rules;
+} Profile;
+
+// A compiled rule and its place in a profile (for sorting the rules by it)
+typedef struct RuleOrder{
+    Rule* rule;
+    RuleProfile* profile;
+} RuleOrder;
+
 // A Database holds an array of Rules
 typedef struct Database{
     int numberOfRules;
     Rule** rules;
+
+    int numberOfBracketPairs;
+    char** brackets; // open then close token of each pair declared with @brackets
+
+    char* fileString; // contents of the file until every rule is parsed
+    char** ruleStrings; // each rule's text inside fileString
 } Database;
 
 
+// words of a bloom filter of symbols (the required literals of a clause, the tokens of a request)
+#define DISPATCH_FILTER_WORDS 4
+
+// A Dispatch finds the clauses that could match an array of tokens in one sweep.
+// It is an Aho-Corasick automaton over the longest literal run of every compiled clause
+// together with an index of the symbols each clause can start with.
+// A clause is a candidate once both its literal run and one of its first symbols were seen
+// (and it is only tried while its required literals may be among the tokens).
+typedef struct Dispatch{
+    int numberOfClauses;
+    char* presetMarks; // marks every clause starts with (without a literal run or with firstAny)
+    int longestAnchor; // longest literal run of any clause
+
+    int numberOfNodes;
+    int* edgeStart; // edges of each node (numberOfNodes+1 length)
+    int* edgeSymbols; // sorted by symbol within each node
+    int* edgeTargets;
+    int* failures; // failure link of each node
+    int* outputHeads; // first output of each node (-1 = none)
+    int* outputLinks; // nearest node along the failure links with outputs (-1 = none)
+
+    int numberOfOutputs;
+    int* outputNext; // next output of the same node (-1 = none)
+    int* outputClauses; // clause number of each output
+
+    // index from a symbol to the clauses whose FIRST set contains it
+    int numberOfSymbols;
+    int* firstStart; // numberOfSymbols+1 length
+    int* firstClauses;
+
+    // DISPATCH_FILTER_WORDS words per clause: a bloom filter of the symbols every match contains
+    // (the tokens that must repeat at least once and have a single alternative)
+    uint64_t* requiredLiterals;
+} Dispatch;
+
+// Limits on the work of one request (0 = no limit)
+typedef struct Limits{
+    long nanoseconds; // wall time from the start of Engine_execute
+    int passes; // rewrite passes (over every bracket segment and the whole input)
+    long substitutions;
+} Limits;
+
 // An Engine holds an array of databases and an array of CompiledRules
 typedef struct Engine{
-    int internalVariable; // keeps track of the next internal variable
+    SymbolTable* symbols; // every token of the databases (read only once compiled)
     int numberOfDatabases;
     Database** databases;
 
     int numberOfCompiledRules;
     Rule** compiledRules; // rules that are ready to execute
+
+    Dispatch* dispatch; // finds the candidate clauses for an array of tokens
+
+    int timeClauses; // 1 = time every match attempt and substitution in the clause counters
+    Limits limits; // the limits every new Context starts with
+
+    // bracket pairs declared by the databases (segments between them are rewritten innermost first)
+    int numberOfBracketPairs;
+    int* brackets; // symbol ids of the open then close token of each pair
+
+    Arena* compiledArena; // memory of the compiled matchers (lives as long as the engine)
+    int numberOfWorkerArenas;
+    Arena** workerArenas; // compiledArena then one arena for each other thread that compiled matchers
+    int largestAutomaton; // most states of any matcher
+    int largestCaptureSize; // largest captureSize of any matcher
+
+    void* image; // mapped compiled image the rules point into (NULL = compiled from databases)
+    size_t imageSize;
 } Engine;
 
+// An EngineLoad holds what the threads of Engine_init share
+typedef struct EngineLoad{
+    Engine* engine;
+    char** databaseFilenames; // NULL when the databases are read from databaseStrings
+    char** databaseStrings;
+
+    // every rule of every database in order
+    int* ruleDatabases; // database of each rule
+    int* ruleIndices; // index of each rule within its database
+
+    Clause** clauses; // every clause of every compiled rule in order
+} EngineLoad;
+
+// A MemoEntry holds the normal form of a balanced bracket segment
+typedef struct MemoEntry{
+    uint64_t hash;
+    int length;
+    int* segment; // the segment's tokens (brackets included)
+    int normalLength;
+    int* normalForm;
+    struct MemoEntry* next; // next entry in the same bucket
+} MemoEntry;
+
+// A Memo remembers the normal forms of the segments of one request
+typedef struct Memo{
+    int numberOfBuckets; // always a power of 2
+    MemoEntry** buckets;
+    int numberOfEntries;
+} Memo;
+
+// A CacheEntry holds the result of one request
+typedef struct CacheEntry{
+    uint64_t hash;
+    int metric;
+    int direction;
+    char* request; // the request exactly as it was received
+    size_t requestLength;
+    char* result; // the printed result
+    size_t resultLength;
+
+    struct CacheEntry* next; // next entry in the same bucket
+    struct CacheEntry* newer; // recency list
+    struct CacheEntry* older;
+} CacheEntry;
+
+// A Cache remembers the results of recent requests, evicting the least recently used ones
+// It is shared by every Context, so every access holds its lock
+typedef struct Cache{
+    int maxEntries;
+    size_t maxBytes; // 0 = no byte limit
+    int numberOfEntries;
+    size_t bytes; // entries, requests and results together
+
+    int numberOfBuckets; // always a power of 2
+    CacheEntry** buckets;
+    CacheEntry* newest;
+    CacheEntry* oldest;
+
+    long hits;
+    long misses;
+    long evictions;
+
+    pthread_mutex_t lock;
+} Cache;
+
+// A History remembers enough of the tokens after every pass of a rewrite to find a repeated state (a cycle)
+// Only one earlier state is kept in full, which moves to the latest pass at powers of two (Brent's cycle detection).
+typedef struct History{
+    int numberOfStates; // state 0 = the tokens before the first pass, state p = after pass p
+
+    // the state every later one is compared with
+    int savedState;
+    int power; // the saved state moves on when the distance to it reaches power
+    int savedLength;
+    int savedCapacity;
+    int* savedTokens;
+
+    int numberOfRules;
+    int ruleCapacity;
+    int* rules; // the rules that made substitutions after the saved state, pass after pass
+
+    // the best state seen so far (fewest tokens when minimizing, most when maximizing, earliest on ties)
+    int direction;
+    int bestState;
+    int bestLength;
+    int bestCapacity;
+    int* bestTokens;
+} History;
+
+// One substitution recorded by a Trace
+typedef struct TraceEvent{
+    int pass; // pass of the rewrite it was made in (from 1)
+    int segment; // offset of the bracket segment being rewritten (-1 = the whole input)
+    int rule; // index among the compiled rules
+    int sourceClause; // the clause that matched
+    int targetClause; // the clause it was replaced by
+    int offset;
+    int length; // tokens matched
+    int replacementLength;
+    long nanoseconds; // since the request started
+} TraceEvent;
+
+// A Trace keeps the last substitutions of the current request in a ring buffer
+// (only its Context's thread writes and reads it, so it takes no lock)
+typedef struct Trace{
+    int capacity; // a power of two
+    long numberOfEvents; // recorded since the request started (only the last capacity are kept)
+    TraceEvent* events;
+    long start; // Stats_now() when the request started
+    int numberOfPasses; // over every rewrite of the request
+
+    // the last cycle the request stopped (cycleEnd = -1 when none)
+    int cycleSegment;
+    int cycleStart; // the state after this pass came back
+    int cycleEnd; // after this pass
+    int cycleLength; // tokens of the best state the rewrite stopped with
+
+    int stopped; // the LIMIT_* that cut the request short (0 = none)
+
+    // where the engine is (kept up to date only while tracing)
+    int pass;
+    int segment;
+    int rule;
+} Trace;
+
+// A Context holds the mutable state needed to execute an Engine on one request at a time
+typedef struct Context{
+    Engine* engine;
+    int internalVariable; // keeps track of the next internal variable
+    Cache* cache; // results of earlier requests shared with other Contexts (NULL = none)
+    SymbolTable* symbols; // tokens of the current request the engine has never seen (ids follow the engine's)
+
+    // symbol ids of the current request
+    int inputCapacity;
+    int* inputTokens;
+
+    Arena* arena; // match results and replacements (reset for every request)
+    char* candidates; // candidate marks of every compiled clause
+    uint64_t presentTokens[DISPATCH_FILTER_WORDS]; // bloom filter of the symbols among the tokens (only added to during a rewrite)
+
+    // normal forms of the request's bracket segments (NULL unless the engine has bracket pairs)
+    Memo* memo;
+    int segmentCapacity;
+    int* segmentStarts; // offsets of the open brackets that are not closed yet
+    int* segmentPairs; // their bracket pairs
+
+    // scratch space for the matcher sized for the engine's largest automaton
+    ThreadList threadLists[2];
+    int* visited;
+    int* captures;
+    int* matchCaptures;
+
+    // totals over every request this Context executed (written with COUNTER_ADD)
+    long numberOfExecutions;
+    long numberOfPasses;
+    long numberOfSubstitutions;
+    int pass; // pass of the current rewrite
+    long numberOfCycles; // rewrites stopped because the tokens came back to an earlier state
+    long numberOfPartials; // requests stopped early by their limits
+    long* ruleCycles; // for every compiled rule, the cycles it made a substitution in
+    ClauseCounters* clauseCounters; // counters of every compiled clause
+    RequestHistograms* histograms;
+    History* history; // the states of the current rewrite
+
+    // the limits of each request and what is left of them for the current one
+    Limits limits;
+    int stopped; // the LIMIT_* that stopped the current request (0 = none)
+    long deadline; // Stats_now() the request has to end by (0 = none)
+    int deadlineCountdown; // CONTEXT_EXPIRED checks left before the clock is read again
+    int passesLeft; // -1 = no limit
+    long substitutionsLeft; // -1 = no limit
+
+    int tracing; // 1 = record the substitutions of each request in trace
+    Trace* trace; // NULL until tracing is first enabled
+} Context;
+
+// A ParallelFor hands out the indices of a loop to a pool of threads
+typedef struct ParallelFor{
+    int count;
+    int next; // next index to hand out (taken atomically)
+    void (*body)(void* data, int index, int worker);
+    void* data;
+} ParallelFor;
+
+// A ParallelWorker runs indices of a ParallelFor
+typedef struct ParallelWorker{
+    ParallelFor* loop;
+    int worker;
+    pthread_t thread;
+} ParallelWorker;
+
+// An OutputBuffer collects printed results
+typedef struct OutputBuffer{
+    char* bytes;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+// A BatchSlot holds a chunk of input lines and their results
+typedef struct BatchSlot{
+    int state; // BATCH_SLOT_EMPTY, BATCH_SLOT_FILLED or BATCH_SLOT_DONE
+
+    // the lines (each with its newline) one after another
+    char* text;
+    size_t textLength;
+    size_t textCapacity;
+    int numberOfLines;
+    int lineCapacity;
+    size_t* lineStarts;
+    size_t* lineLengths;
+
+    OutputBuffer output; // results of every line in order
+} BatchSlot;
+
+struct Batch;
+
+// A BatchWorker executes chunks of a Batch with its own Context
+typedef struct BatchWorker{
+    struct Batch* batch;
+    Context* context;
+    pthread_t thread;
+} BatchWorker;
+
+// A Batch runs a pool of workers that share one read only Engine over chunks of input lines
+// and writes their results in input order
+typedef struct Batch{
+    Engine* engine;
+    int metric;
+    int direction;
+
+    int numberOfWorkers;
+    BatchWorker* workers;
+
+    // ring of chunks (chunk n lives in slot n % numberOfSlots)
+    int numberOfSlots;
+    BatchSlot* slots;
+    long nextRead; // next chunk the reader fills
+    long nextWork; // next chunk a worker takes
+    long nextWrite; // next chunk the writer prints
+    int finished; // 1 = the reader reached EOF
+
+    pthread_mutex_t lock;
+    pthread_cond_t slotFilled;
+    pthread_cond_t slotDone;
+    pthread_cond_t slotFree;
+} Batch;
+
+// Stats gathers the counters of every Context executing an Engine for dumps
+typedef struct Stats{
+    Engine* engine;
+
+    pthread_mutex_t lock;
+    int numberOfContexts;
+    int contextCapacity;
+    Context** contexts;
+
+    FILE* signalOutput; // where a SIGUSR1 dump goes
+    char* snapshotPath; // the JSON snapshot rewritten every snapshotInterval seconds (NULL = none)
+    int snapshotInterval;
+    int listening; // 1 once the signal thread runs
+    int stopping;
+    pthread_t signalThread;
+} Stats;
+
+struct ServerClient;
+
+// A ServerJob is one request of a client
+typedef struct ServerJob{
+    struct ServerClient* client;
+    char* request; // the request line (with its newline)
+    size_t requestLength;
+    OutputBuffer output; // the response once done
+    int done; // 1 = the event loop collected the response
+
+    struct ServerJob* nextInClient; // next request of the same client
+    struct ServerJob* nextQueued; // next job in the work queue or the finished list
+} ServerJob;
+
+// A ServerClient is one connection to a Server
+typedef struct ServerClient{
+    int fd;
+    int readClosed; // 1 = the client will not send more requests
+    int failed; // 1 = the connection broke (responses are dropped)
+
+    OutputBuffer input; // received bytes that do not form a whole request yet
+    OutputBuffer pending; // response bytes not written yet
+    size_t pendingStart; // first byte of pending not written yet
+
+    // requests in the order they were received (responses are written in this order)
+    ServerJob* firstJob;
+    ServerJob* lastJob;
+} ServerClient;
+
+struct Server;
+
+// A ServerWorker executes jobs of a Server with its own Context
+typedef struct ServerWorker{
+    struct Server* server;
+    Context* context;
+    pthread_t thread;
+} ServerWorker;
+
+// A Server answers requests of many clients on a Unix socket.
+// One thread runs the event loop over every connection and a pool of workers executes the requests.
+typedef struct Server{
+    Engine* engine;
+    int binary; // requests are frames (see frame.h) instead of lines
+    Cache* cache; // shared by every worker (NULL = none)
+    Stats* stats; // answers the stats command (NULL = none)
+    char* path;
+
+    int listenFd;
+    int epollFd;
+    int wakeFd; // eventfd the workers signal when a job is done
+
+    int numberOfWorkers;
+    ServerWorker* workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t jobQueued;
+    ServerJob* queueHead; // jobs waiting for a worker
+    ServerJob* queueTail;
+    ServerJob* finished; // jobs done since the event loop last looked
+    int stopping;
+} Server;
+
+// An RbeEngine is the Engine behind the handle of the shared library (see librbe.h)
+typedef struct RbeEngine{
+    Engine* engine;
+
+    pthread_mutex_t lock;
+    int numberOfIdleContexts;
+    int idleCapacity;
+    Context** idleContexts; // Contexts no call is using (one is created when a call finds none)
+} RbeEngine;
+
+// An RbeResult holds the tokens returned by the shared library in one allocation
+typedef struct RbeResult{
+    int numberOfTokens;
+    char** tokens; // each points into the same allocation
+    size_t textLength; // bytes of the tokens (each followed by a NUL) after the pointers
+    int partial; // 1 = a limit stopped the rewrite before its fixpoint
+} RbeResult;
+
+// An ImageHeader starts a compiled image of an Engine.
+// Every array is stored once in the image and referenced by its offset from the start of the image.
+typedef struct ImageHeader{
+    char magic[4]; // IMAGE_MAGIC
+    int32_t version; // IMAGE_VERSION
+    int32_t byteOrder; // IMAGE_BYTE_ORDER as written by the compiling machine
+    int32_t headerSize; // sizeof(ImageHeader)
+    int64_t imageSize;
+
+    // symbols: offset of each NUL terminated string and the hash buckets
+    int32_t numberOfSymbols;
+    int32_t numberOfBuckets;
+    int64_t symbolOffsets;
+    int64_t buckets;
+
+    int32_t numberOfRules;
+    int32_t numberOfClauses;
+    int64_t rules; // numberOfRules ImageRules
+    int64_t clauses; // numberOfClauses ImageClauses in rule order
+
+    int32_t largestAutomaton;
+    int32_t largestCaptureSize;
+
+    int32_t numberOfBracketPairs;
+    int64_t brackets; // open then close symbol of each pair
+
+    // dispatch
+    int32_t longestAnchor;
+    int32_t numberOfNodes;
+    int32_t numberOfOutputs;
+    int32_t numberOfDispatchSymbols;
+    int32_t padding;
+    int64_t presetMarks;
+    int64_t edgeStart;
+    int64_t edgeSymbols;
+    int64_t edgeTargets;
+    int64_t failures;
+    int64_t outputHeads;
+    int64_t outputLinks;
+    int64_t outputNext;
+    int64_t outputClauses;
+    int64_t firstStart;
+    int64_t firstClauses;
+    int64_t requiredLiterals;
+} ImageHeader;
+
+// An ImageRule is a Rule in a compiled image
+typedef struct ImageRule{
+    int32_t numberOfClauses;
+    int32_t firstClause;
+    int32_t numberOfMetrics;
+    int32_t number;
+    int64_t minimalMetric;
+    int64_t maximalMetric;
+} ImageRule;
+
+// An ImageClause is a Clause and its Matcher in a compiled image
+typedef struct ImageClause{
+    int32_t numberOfTokens;
+    int32_t numberOfMetrics;
+    int64_t tokens;
+    int64_t metrics;
+
+    int64_t minRepetitions;
+    int64_t maxRepetitions;
+    int64_t variableAccesses;
+    int64_t internalVariables;
+    int64_t numberOfMatchingTokens;
+    int64_t matchingTokens; // the alternatives of every token one after another
+
+    int32_t numberOfStates;
+    int32_t numberOfVariables;
+    int32_t captureSize;
+    int32_t firstAny;
+    int32_t numberOfFirstTokens;
+    int64_t stateBase;
+    int64_t stateTokens;
+    int64_t stateRepetitions;
+    int64_t firstTokens;
+} ImageClause;
+
 #endif
@@ -0,0 +1,160 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "arena.h"
+#include "symbol.h"
+
+#define SYMBOL_TABLE_INITIAL_BUCKETS 64
+#define SYMBOL_TABLE_STRING_BLOCK_SIZE 4096
+
+///////////////////////////////////////////
+// Private Functions
+
+// FNV-1a hash of the first length bytes of a string
+unsigned int hashSymbol(char* symbol, size_t length){
+    unsigned int hash = 2166136261u;
+    for (size_t i=0; i<length; i++){
+        hash ^= (unsigned char) symbol[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// find the bucket a symbol (length bytes, not terminated) lives in (or the empty bucket it would go in)
+int SymbolTable_findBucket(SymbolTable* instance, char* symbol, size_t length){
+    unsigned int mask = instance->numberOfBuckets - 1;
+    unsigned int bucket = hashSymbol(symbol, length) & mask;
+    while (instance->buckets[bucket] != -1){
+        int id = instance->buckets[bucket];
+        if (instance->lengths[id] == length && memcmp(instance->symbols[id], symbol, length) == 0){
+            break;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+// double the number of buckets and rehash every symbol
+int SymbolTable_grow(SymbolTable* instance){
+    free(instance->buckets);
+
+    instance->numberOfBuckets *= 2;
+    instance->buckets = (int*) malloc(sizeof(int) * instance->numberOfBuckets);
+    for (int i=0; i<instance->numberOfBuckets; i++){
+        instance->buckets[i] = -1;
+    }
+
+    for (int i=0; i<instance->numberOfSymbols; i++){
+        int bucket = SymbolTable_findBucket(instance, instance->symbols[i], instance->lengths[i]);
+        instance->buckets[bucket] = i;
+    }
+
+    DBG("Symbol table grown to %d buckets\n", instance->numberOfBuckets);
+    return 0;
+}
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new SymbolTable
+SymbolTable* SymbolTable_init(){
+    SymbolTable* result = (SymbolTable*) malloc(sizeof(SymbolTable));
+
+    result->numberOfSymbols = 0;
+    result->capacity = 0;
+    result->symbols = NULL;
+    result->lengths = NULL;
+    result->strings = Arena_init(SYMBOL_TABLE_STRING_BLOCK_SIZE);
+
+    result->numberOfBuckets = SYMBOL_TABLE_INITIAL_BUCKETS;
+    result->buckets = (int*) malloc(sizeof(int) * result->numberOfBuckets);
+    for (int i=0; i<result->numberOfBuckets; i++){
+        result->buckets[i] = -1;
+    }
+
+    return result;
+}
+
+// get the id of a symbol, adding it to the table if it is new
+int SymbolTable_intern(SymbolTable* instance, char* symbol){
+    return SymbolTable_internRange(instance, symbol, strlen(symbol));
+}
+
+// get the id of the symbol in the first length bytes of a buffer, adding it to the table if it is new
+// the buffer does not need to be terminated (only new symbols are copied)
+int SymbolTable_internRange(SymbolTable* instance, char* symbol, size_t length){
+    int bucket = SymbolTable_findBucket(instance, symbol, length);
+    if (instance->buckets[bucket] != -1){
+        return instance->buckets[bucket];
+    }
+
+    // add a terminated copy of the symbol
+    if (instance->numberOfSymbols == instance->capacity){
+        instance->capacity = instance->capacity ? instance->capacity * 2 : 64;
+        instance->symbols = realloc(instance->symbols, sizeof(char*) * instance->capacity);
+        instance->lengths = realloc(instance->lengths, sizeof(size_t) * instance->capacity);
+    }
+    int id = instance->numberOfSymbols;
+    char* copy = (char*) Arena_alloc(instance->strings, length + 1);
+    memcpy(copy, symbol, length);
+    copy[length] = '\0';
+    instance->symbols[id] = copy;
+    instance->lengths[id] = length;
+    instance->numberOfSymbols++;
+    instance->buckets[bucket] = id;
+
+    DBG("Interned symbol %d: %s\n", id, copy);
+
+    // keep the load factor under 1/2
+    if (instance->numberOfSymbols * 2 > instance->numberOfBuckets){
+        SymbolTable_grow(instance);
+    }
+
+    return id;
+}
+
+// get the id of a symbol without adding it (-1 = not found)
+int SymbolTable_find(SymbolTable* instance, char* symbol){
+    return SymbolTable_findRange(instance, symbol, strlen(symbol));
+}
+
+// get the id of the symbol in the first length bytes of a buffer without adding it (-1 = not found)
+int SymbolTable_findRange(SymbolTable* instance, char* symbol, size_t length){
+    return instance->buckets[SymbolTable_findBucket(instance, symbol, length)];
+}
+
+// get the string for a symbol id
+char* SymbolTable_lookup(SymbolTable* instance, int id){
+    return instance->symbols[id];
+}
+
+// get the length in bytes of the string for a symbol id
+size_t SymbolTable_lookupLength(SymbolTable* instance, int id){
+    return instance->lengths[id];
+}
+
+// remove every symbol from a SymbolTable, keeping its buckets for reuse
+int SymbolTable_clear(SymbolTable* instance){
+    if (instance->numberOfSymbols == 0){
+        return 0;
+    }
+    Arena_reset(instance->strings);
+    instance->numberOfSymbols = 0;
+    for (int i=0; i<instance->numberOfBuckets; i++){
+        instance->buckets[i] = -1;
+    }
+    return 0;
+}
+
+// free a SymbolTable and all of its symbols
+int SymbolTable_free(SymbolTable* instance){
+    Arena_free(instance->strings);
+    free(instance->symbols);
+    free(instance->lengths);
+    free(instance->buckets);
+    free(instance);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <stddef.h>
+
+#include "structures.h"
+
+// initialize a new SymbolTable
+SymbolTable* SymbolTable_init();
+
+// get the id of a symbol, adding it to the table if it is new
+int SymbolTable_intern(SymbolTable* instance, char* symbol);
+
+// get the id of the symbol in the first length bytes of a buffer, adding it to the table if it is new
+// the buffer does not need to be terminated (only new symbols are copied)
+int SymbolTable_internRange(SymbolTable* instance, char* symbol, size_t length);
+
+// get the id of a symbol without adding it (-1 = not found)
+int SymbolTable_find(SymbolTable* instance, char* symbol);
+
+// get the id of the symbol in the first length bytes of a buffer without adding it (-1 = not found)
+int SymbolTable_findRange(SymbolTable* instance, char* symbol, size_t length);
+
+// get the string for a symbol id
+char* SymbolTable_lookup(SymbolTable* instance, int id);
+
+// get the length in bytes of the string for a symbol id
+size_t SymbolTable_lookupLength(SymbolTable* instance, int id);
+
+// remove every symbol from a SymbolTable, keeping its buckets for reuse
+int SymbolTable_clear(SymbolTable* instance);
+
+// free a SymbolTable and all of its symbols
+int SymbolTable_free(SymbolTable* instance);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+
+#include "debug.h"
+#include "structures.h"
+
+#include "clause.h"
+#include "stats.h"
+#include "trace.h"
+
+///////////////////////////////////////////
+// Public Functions
+
+// initialize a new Trace keeping the last capacity substitutions (rounded up to a power of two)
+Trace* Trace_init(int capacity){
+    Trace* result = (Trace*) malloc(sizeof(Trace));
+    result->capacity = 1;
+    while (result->capacity < capacity){
+        result->capacity *= 2;
+    }
+    result->events = (TraceEvent*) malloc(sizeof(TraceEvent) * result->capacity);
+    Trace_clear(result);
+    return result;
+}
+
+// forget the previous request's substitutions and restart the clock
+int Trace_clear(Trace* instance){
+    instance->numberOfEvents = 0;
+    instance->numberOfPasses = 0;
+    instance->start = Stats_now();
+    instance->pass = 0;
+    instance->segment = -1;
+    instance->rule = -1;
+    instance->cycleEnd = -1;
+    instance->stopped = 0;
+    return 0;
+}
+
+// record a substitution of the current rule at the current pass
+int Trace_record(Trace* instance, int sourceClause, int targetClause, int offset, int length, int replacementLength){
+    // the oldest event is overwritten once the buffer is full
+    TraceEvent* event = &instance->events[instance->numberOfEvents & (instance->capacity - 1)];
+    event->pass = instance->pass;
+    event->segment = instance->segment;
+    event->rule = instance->rule;
+    event->sourceClause = sourceClause;
+    event->targetClause = targetClause;
+    event->offset = offset;
+    event->length = length;
+    event->replacementLength = replacementLength;
+    event->nanoseconds = Stats_now() - instance->start;
+    instance->numberOfEvents++;
+    return 0;
+}
+
+// print the substitutions of the request in the order they were made, with the clauses of each
+int Trace_explain(Trace* instance, Engine* engine, FILE* fp){
+    fprintf(fp, "explain: %ld substitutions in %d passes, %.3f ms\n", instance->numberOfEvents, instance->numberOfPasses, (Stats_now() - instance->start) / 1e6);
+
+    if (instance->cycleEnd != -1){
+        if (instance->cycleSegment != -1){
+            fprintf(fp, "  segment at %d: ", instance->cycleSegment);
+        } else {
+            fprintf(fp, "  ");
+        }
+        fprintf(fp, "cycle: the tokens after pass %d repeat the tokens ", instance->cycleEnd);
+        if (instance->cycleStart == 0){
+            fprintf(fp, "before pass 1");
+        } else {
+            fprintf(fp, "after pass %d", instance->cycleStart);
+        }
+        fprintf(fp, ", stopped at the best state seen (%d tokens), rules", instance->cycleLength);
+
+        // the rules of the cycle are the rules of its recorded substitutions
+        long first = instance->numberOfEvents > instance->capacity ? instance->numberOfEvents - instance->capacity : 0;
+        for (long i=first; i<instance->numberOfEvents; i++){
+            TraceEvent* event = &instance->events[i & (instance->capacity - 1)];
+            if (event->segment != instance->cycleSegment || event->pass <= instance->cycleStart || event->pass > instance->cycleEnd){
+                continue;
+            }
+            int repeated = 0;
+            for (long j=first; j<i && !repeated; j++){
+                TraceEvent* earlier = &instance->events[j & (instance->capacity - 1)];
+                repeated = earlier->rule == event->rule && earlier->segment == event->segment && earlier->pass > instance->cycleStart && earlier->pass <= instance->cycleEnd;
+            }
+            if (!repeated){
+                fprintf(fp, " %d", engine->compiledRules[event->rule]->number);
+            }
+        }
+        fprintf(fp, "\n");
+    }
+
+    if (instance->stopped != 0){
+        char* reasons[] = {"", "the deadline passed", "the pass limit was reached", "the substitution limit was reached"};
+        fprintf(fp, "  partial: %s, stopped at the tokens reached so far\n", reasons[instance->stopped]);
+    }
+
+    long first = 0;
+    if (instance->numberOfEvents > instance->capacity){
+        first = instance->numberOfEvents - instance->capacity;
+        fprintf(fp, "  (the first %ld substitutions were dropped)\n", first);
+    }
+    for (long i=first; i<instance->numberOfEvents; i++){
+        TraceEvent* event = &instance->events[i & (instance->capacity - 1)];
+        Rule* rule = engine->compiledRules[event->rule];
+
+        fprintf(fp, "  ");
+        if (event->segment != -1){
+            fprintf(fp, "segment at %d, ", event->segment);
+        }
+        fprintf(fp, "pass %d, rule %d at %d: \"", event->pass, rule->number, event->offset);
+        Clause_print(rule->clauses[event->sourceClause], engine->symbols, fp);
+        fprintf(fp, "\" (%d tokens) -> \"", event->length);
+        Clause_print(rule->clauses[event->targetClause], engine->symbols, fp);
+        fprintf(fp, "\" (%d tokens), %.3f ms\n", event->replacementLength, event->nanoseconds / 1e6);
+    }
+    return 0;
+}
+
+// free a Trace
+int Trace_free(Trace* instance){
+    free(instance->events);
+    free(instance);
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+#include "structures.h"
+
+// initialize a new Trace keeping the last capacity substitutions (rounded up to a power of two)
+Trace* Trace_init(int capacity);
+
+// forget the previous request's substitutions and restart the clock
+int Trace_clear(Trace* instance);
+
+// record a substitution of the current rule at the current pass
+int Trace_record(Trace* instance, int sourceClause, int targetClause, int offset, int length, int replacementLength);
+
+// print the substitutions of the request in the order they were made, with the clauses of each
+int Trace_explain(Trace* instance, Engine* engine, FILE* fp);
+
+// free a Trace
+int Trace_free(Trace* instance);
+
+#endif